@@ -0,0 +1,127 @@
+/*
+ * cxxbench.cc - Compile-time sized allocation benchmark for mm.hpp
+ *
+ * For a few node sizes, time a loop that allocates a batch of nodes and
+ * frees them again, once with mm::alloc<sizeof(T)>/mm::free<sizeof(T)>
+ * and once with mm_malloc(sizeof(T))/mm_free. The heap is reset before
+ * each run, so both start from an empty small-class cache.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mm.hpp"
+extern "C" {
+#include "memlib.h"
+}
+
+/* Defaults, overridden on the command line */
+#define ROUNDS   20000      /* batches allocated and freed per run */
+#define BATCH       32      /* nodes live at once */
+
+template <std::size_t N>
+struct node {
+    char bytes[N];
+};
+
+static double now(void);
+static void usage(void);
+
+/*
+ * run - Time rounds batches of N-byte nodes, allocated with the
+ *     templates if tmpl is set and with mm_malloc otherwise. Returns
+ *     nanoseconds per malloc+free pair
+ */
+template <std::size_t N>
+static double run(int rounds, bool tmpl)
+{
+    void *p[BATCH];
+    double start;
+    int i, r;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "cxxbench: mm_init failed\n");
+        exit(1);
+    }
+
+    start = now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < BATCH; i++) {
+            p[i] = tmpl ? mm::alloc<sizeof(node<N>)>()
+                        : mm_malloc(sizeof(node<N>));
+            if (p[i] == NULL) {
+                fprintf(stderr, "cxxbench: allocation failed\n");
+                exit(1);
+            }
+            *(volatile char *)p[i] = 0;   /* touch the node */
+        }
+        for (i = 0; i < BATCH; i++) {
+            if (tmpl)
+                mm::free<sizeof(node<N>)>(p[i]);
+            else
+                mm_free(p[i]);
+        }
+    }
+    return (now() - start) * 1e9 / ((double)rounds * BATCH);
+}
+
+template <std::size_t N>
+static void report(int rounds)
+{
+    double t = run<N>(rounds, true);
+    double m = run<N>(rounds, false);
+
+    printf("%6zu%14.1f%14.1f\n", N, t, m);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int rounds = ROUNDS;
+
+    while ((c = getopt(argc, argv, "o:h")) != EOF) {
+        switch (c) {
+        case 'o': /* Batches per run */
+            rounds = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    mem_init();
+    printf("%6s%14s%14s   (ns per malloc+free)\n", "size", "mm::alloc", "mm_malloc");
+    report<8>(rounds);
+    report<24>(rounds);
+    report<48>(rounds);
+    report<64>(rounds);
+    report<120>(rounds);
+    report<256>(rounds);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * now - Wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: cxxbench [-h] [-o <rounds>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-o <rounds>   Batches of %d nodes per run (default %d).\n", BATCH, ROUNDS);
+}
@@ -0,0 +1,156 @@
+/*
+ * forkbench.c - Pre-fork memory benchmark for the mm package
+ *
+ * The parent fills a heap with blocks of random small sizes and forks a
+ * number of workers. Each worker frees a share of the parent's blocks
+ * at random and allocates as many new ones, then reports its private
+ * dirty memory from /proc/self/smaps_rollup. The run is done with the
+ * heap shared the ordinary way and with mm_set_fork_seal, so the cost
+ * of frees writing tags all over the inherited heap can be compared
+ * with children that leave it alone.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Defaults, overridden on the command line */
+#define CHILDREN     8      /* workers forked per run */
+#define BLOCKS  100000      /* blocks the parent allocates */
+#define MAXSIZE    512      /* largest request size (bytes) */
+#define SHARE       50      /* percent of the parent's blocks a worker frees */
+
+static long run(int seal, int children, int blocks, int share);
+static long private_dirty(void);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    int c;
+    int children = CHILDREN;
+    int blocks = BLOCKS;
+    int share = SHARE;
+    long plain, sealed;
+
+    while ((c = getopt(argc, argv, "b:n:p:h")) != EOF) {
+	switch (c) {
+	case 'b': /* Blocks allocated by the parent */
+	    blocks = atoi(optarg);
+	    break;
+	case 'n': /* Workers forked */
+	    children = atoi(optarg);
+	    break;
+	case 'p': /* Percent of the parent's blocks each worker frees */
+	    share = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    mem_init();
+    plain = run(0, children, blocks, share);
+    sealed = run(1, children, blocks, share);
+    printf("%8s%14s%14s   (private dirty kB, all workers)\n",
+	   "workers", "shared", "sealed");
+    printf("%8d%14ld%14ld\n", children, plain, sealed);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run - Fill a fresh heap, fork the workers and return the sum of
+ *     their private dirty memory in kB
+ */
+static long run(int seal, int children, int blocks, int share)
+{
+    char **p;
+    int fds[2];
+    long kb, total = 0;
+    unsigned int seed = 1;
+    int i, n;
+
+    if ((p = malloc(blocks * sizeof(char *))) == NULL || pipe(fds) < 0) {
+	fprintf(stderr, "forkbench: setup failed\n");
+	exit(1);
+    }
+
+    mem_reset_brk();
+    mm_set_fork_seal(seal);
+    if (mm_init() < 0) {
+	fprintf(stderr, "forkbench: mm_init failed\n");
+	exit(1);
+    }
+    for (i = 0; i < blocks; i++) {
+	n = 1 + rand_r(&seed) % MAXSIZE;
+	if ((p[i] = mm_malloc(n)) == NULL) {
+	    fprintf(stderr, "forkbench: mm_malloc failed\n");
+	    exit(1);
+	}
+	memset(p[i], i, n);
+    }
+
+    for (n = 0; n < children; n++) {
+	if (fork() == 0) {
+	    /* Worker: replace a share of the inherited blocks */
+	    seed = n + 2;
+	    for (i = 0; i < blocks; i++) {
+		if (rand_r(&seed) % 100 < share) {
+		    mm_free(p[i]);
+		    if ((p[i] = mm_malloc(1 + rand_r(&seed) % MAXSIZE)) == NULL)
+			_exit(1);
+		    p[i][0] = (char)i;   /* touch the block */
+		}
+	    }
+	    kb = private_dirty();
+	    write(fds[1], &kb, sizeof(kb));
+	    _exit(0);
+	}
+    }
+    for (n = 0; n < children; n++) {
+	if (read(fds[0], &kb, sizeof(kb)) == sizeof(kb))
+	    total += kb;
+	wait(NULL);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    free(p);
+    return total;
+}
+
+/*
+ * private_dirty - Private dirty memory of this process in kB, or -1
+ */
+static long private_dirty(void)
+{
+    char line[256];
+    long kb = -1;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/smaps_rollup", "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+	    break;
+    fclose(fp);
+    return kb;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: forkbench [-h] [-b <blocks>] [-n <workers>] [-p <percent>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <blocks>   Blocks allocated by the parent (default %d).\n", BLOCKS);
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <workers>  Workers forked per run (default %d).\n", CHILDREN);
+    fprintf(stderr, "\t-p <percent>  Share of the parent's blocks each worker frees (default %d).\n", SHARE);
+}
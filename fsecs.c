@@ -10,7 +10,7 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
-extern int verbose; /* -v option in mdriver.c */
+extern int mmb_verbose; /* -v option in mdriver.c, in libmmbench */
 
 /*
  * init_fsecs - initialize the timing package
@@ -20,7 +20,7 @@ void init_fsecs(void)
     Mhz = 0; /* keep gcc -Wall happy */
 
 #if USE_FCYC
-    if (verbose)
+    if (mmb_verbose)
 	printf("Measuring performance with a cycle counter.\n");
 
     /* set key parameters for the fcyc package */
@@ -29,12 +29,12 @@ void init_fsecs(void)
     set_fcyc_compensate(1);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
+    Mhz = mhz(mmb_verbose > 0);
 #elif USE_ITIMER
-    if (verbose)
+    if (mmb_verbose)
 	printf("Measuring performance with the interval timer.\n");
 #elif USE_GETTOD
-    if (verbose)
+    if (mmb_verbose)
 	printf("Measuring performance with gettimeofday().\n");
 #endif
 }
@@ -12,13 +12,12 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
-#include <assert.h>
 #include <float.h>
 #include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
-#include "fsecs.h"
+#include "mmbench.h"
 #include "config.h"
 
 /**********************
@@ -27,52 +26,14 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
-#define HDRLINES       4 /* number of header lines in a trace file */
-#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
-
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
+#define STARTUP_SHARE 10 /* -H: the first 1/STARTUP_SHARE of a trace is startup */
+#define NTIGHT         2 /* -M: heap limits timed, as percent of the minimum */
+static const int tight_pct[NTIGHT] = {150, 110};
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
-} range_t;
-
-/* Characterizes a single trace operation (allocator request) */
-typedef enum {ALLOC, FREE, REALLOC} RequestType;
-typedef struct {
-    RequestType type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
-/* 
- * Holds the params to the xxx_speed functions, which are timed by fcyc. 
- * This struct is necessary because fcyc accepts only a pointer array
- * as input.
- */
-typedef struct {
-    trace_t *trace;  
-    range_t *ranges;
-} speed_t;
-
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -82,6 +43,12 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    mm_realloc_stats_t realloc;  /* realloc bytes copied/remapped (util run) */
+    int avoided;     /* reallocs that fit the usable size (util run, -u) */
+    double hint_secs[2][2];  /* [mm_init, mm_init_hint][startup, rest] (-H) */
+    size_t peak_heap;        /* peak heap size (util run) */
+    size_t min_heap;         /* smallest heap limit the trace runs in (-M) */
+    double tight_secs[NTIGHT];  /* secs under tight_pct of min_heap (-M) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -89,9 +56,18 @@ typedef struct {
 /********************
  * Global variables
  *******************/
-int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
-char msg[MAXLINE];      /* for whenever we need to compose an error message */
+
+/* The mm package as the replays call it (mm_free_async with -F,
+   mm_malloc_usable and mm_realloc_usable with -u) */
+static void *mm_malloc_usable(uint32_t size);
+static void *mm_realloc_usable(void *ptr, uint32_t size);
+static mmb_alloc_t mm_alloc = {
+    "mm_malloc", mm_init, mm_init_hint, mm_malloc, mm_free, mm_realloc, 1
+};
+static int reallocs_avoided = 0;  /* growing reallocs -u has skipped */
+static uint32_t *asked_sizes;     /* -u: last size asked for, by heap offset */
+static int verbose = 0;  /* -v or -V, passed on to libmmbench */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -106,31 +82,14 @@ static const char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
-
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
-
-/* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
-static void eval_mm_speed(void *ptr);
-
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printrealloc(int n, stats_t *stats);
+static void printhint(int n, stats_t *stats);
+static void printminheap(int n, stats_t *stats);
+static void dump_heap(mmb_trace_t *trace, const char *dir, const char *tracefile);
 static void usage(void);
 static void unix_error(const char *msg);
-static void malloc_error(int tracenum, int opnum, const char *msg);
 static void app_error(const char *msg);
 
 /**************
@@ -138,19 +97,21 @@ static void app_error(const char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, j;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    mmb_trace_t *trace = NULL;     /* stores a single trace file in memory */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    mmb_opts_t opts;           /* how the replays are timed */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int hint_runs = 0;   /* If set, also time with mm_init_hint (-H) */
+    int min_runs = 0;    /* If set, find and time the smallest heap (-M) */
+    char *dump_dir = NULL; /* If set, dump the heap at each peak here (-D) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -159,7 +120,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalFuHMD:G:k:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -186,6 +147,34 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'F': /* Replay frees with mm_free_async */
+            mm_alloc.free = mm_free_async;
+            break;
+        case 'H': /* Also time startup and steady state with mm_init_hint */
+            hint_runs = 1;
+            break;
+        case 'M': /* Find the smallest heap each trace runs in */
+            min_runs = 1;
+            break;
+        case 'D': /* Dump the heap at each trace's peak into a directory */
+            dump_dir = optarg;
+            break;
+        case 'u': /* Skip reallocs that fit the block's usable size */
+            if (asked_sizes == NULL &&
+                (asked_sizes = calloc(MAX_HEAP / ALIGNMENT,
+                                      sizeof(uint32_t))) == NULL)
+                unix_error("asked_sizes calloc in main failed");
+            mm_alloc.malloc = mm_malloc_usable;
+            mm_alloc.realloc = mm_realloc_usable;
+            break;
+        case 'k': /* Tightest of the first k fits (0 = adaptive, -1 = lowest) */
+            mm_set_fit(atoi(optarg));
+            break;
+        case 'G': /* Sample one request in n into guarded slots */
+            mm_set_guard_rate(atoi(optarg));
+            mm_alloc.off_heap = mm_is_guarded;
+            mm_alloc.off_heap_bytes = mm_guard_bytes;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -200,6 +189,7 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+    mmb_verbose = verbose;
 	
     /* 
      * Check and print team info 
@@ -237,9 +227,6 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
-    /* Initialize the timing package */
-    init_fsecs();
-
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -254,18 +241,19 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    if ((trace = mmb_read_trace(tracedir, tracefiles[i])) == NULL)
+		exit(1);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
+	    libc_stats[i].valid = mmb_valid(&mmb_libc, trace, i);
 	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if ((libc_stats[i].secs = mmb_secs(&mmb_libc, trace, NULL)) < 0)
+		    app_error("libc malloc failed in mmb_secs");
 	    }
-	    free_trace(trace);
+	    mmb_free_trace(trace);
 	}
 
 	/* Display the libc results in a compact table */
@@ -291,22 +279,51 @@ int main(int argc, char **argv)
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
+	if ((trace = mmb_read_trace(tracedir, tracefiles[i])) == NULL)
+	    exit(1);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
+	mm_stats[i].valid = mmb_valid(&mm_alloc, trace, i);
+	if (!mm_stats[i].valid)
+	    errors++;
+	else {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
+	    reallocs_avoided = 0;
+	    if ((mm_stats[i].util = mmb_util(&mm_alloc, trace, NULL)) < 0)
+		app_error("mm_malloc failed in mmb_util");
+	    mm_stats[i].peak_heap = mem_peak_heapsize();
+	    mm_stats[i].avoided = reallocs_avoided;
+	    mm_realloc_stats(&mm_stats[i].realloc);
+	    memset(&opts, 0, sizeof(opts));
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if ((mm_stats[i].secs = mmb_secs(&mm_alloc, trace, &opts)) < 0)
+		app_error("mm_malloc failed in mmb_secs");
+
+	    /* The first 1/STARTUP_SHARE of the requests is the startup */
+	    for (j = 0; hint_runs && j < 2; j++) {
+		opts.hint = j;
+		if (mmb_split_secs(&mm_alloc, trace, &opts,
+				   trace->num_ops / STARTUP_SHARE,
+				   mm_stats[i].hint_secs[j]) < 0)
+		    app_error("mm_malloc failed in mmb_split_secs");
+	    }
+	    opts.hint = 0;
+
+	    /* Timed only under limits the trace is seen to fit in */
+	    if (min_runs)
+		mm_stats[i].min_heap = mmb_min_heap(&mm_alloc, trace, NULL);
+	    for (j = 0; min_runs && j < NTIGHT; j++) {
+		opts.heap_max = mm_stats[i].min_heap * tight_pct[j] / 100;
+		if (mmb_util(&mm_alloc, trace, &opts) >= 0)
+		    mm_stats[i].tight_secs[j] = mmb_secs(&mm_alloc, trace, &opts);
+	    }
+	    if (dump_dir != NULL)
+		dump_heap(trace, dump_dir, tracefiles[i]);
 	}
-	free_trace(trace);
+	mmb_free_trace(trace);
     }
 
     /* Display the mm results in a compact table */
@@ -314,6 +331,16 @@ int main(int argc, char **argv)
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printrealloc(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (hint_runs) {
+	printhint(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (min_runs) {
+	printminheap(num_tracefiles, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -368,563 +395,6 @@ int main(int argc, char **argv)
 }
 
 
-/*****************************************************************
- * The following routines manipulate the range list, which keeps 
- * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
- ****************************************************************/
-
-/*
- * add_range - As directed by request opnum in trace tracenum,
- *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
- */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
-{
-    char *hi = lo + size - 1;
-    range_t *p;
-    char msg[MAXLINE];
-
-    assert(size > 0);
-
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
-	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
-        malloc_error(tracenum, opnum, msg);
-        return 0;
-    }
-
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
-	malloc_error(tracenum, opnum, msg);
-        return 0;
-    }
-
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
-    }
-
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
-     */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
-    return 1;
-}
-
-/* 
- * remove_range - Free the range record of block whose payload starts at lo 
- */
-static void remove_range(range_t **ranges, char *lo)
-{
-    range_t *p;
-    range_t **prevpp = ranges;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            // int size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
-}
-
-/*
- * clear_ranges - free all of the range records for a trace 
- */
-static void clear_ranges(range_t **ranges)
-{
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
-    *ranges = NULL;
-}
-
-
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
-/*
- * read_trace - read a trace file and store it in memory
- */
-static trace_t *read_trace(char *tracedir, char *filename)
-{
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)) ) {
-      unix_error("fscanf of heapsize\n");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->num_ids)) ) {
-      unix_error("fscanf of num_ids");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->num_ops)) ) {
-      unix_error("fscanf of num_ops");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->weight)) ) {
-      unix_error("fscan of weight");
-    }
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	  if ( 2 != fscanf(tracefile, "%u %u", &index, &size) ) {
-	    unix_error("fscanf of allocation");
-	  } 
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	  if ( 2 != fscanf(tracefile, "%u %u", &index, &size) ) {
-	    unix_error("fscanf of relloc");
-	  } 
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	  if ( 1 != fscanf(tracefile, "%ud", &index) ) {
-	    unix_error("fscanf of free\n");
-	  }
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
-}
-
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
-
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
-
-/*
- * eval_mm_valid - Check the mm malloc package for correctness
- */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
-{
-    int i, j;
-    int index;
-    int size;
-    int oldsize;
-    char *newp;
-    char *oldp;
-    char *p;
-    
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
-    clear_ranges(ranges);
-
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
-	return 0;
-    }
-
-    /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
-
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	  if ((p = (char*) mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
-		return 0;
-	    }
-	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
-		return 0;
-	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-	    memset(p, index & 0xFF, size);
-
-	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    break;
-
-        case REALLOC: /* mm_realloc */
-	    
-	    /* Call the student's realloc */
-	    oldp = trace->blocks[index];
-	    if ((newp = (char *) mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
-		return 0;
-	    }
-	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
-	    
-	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
-		return 0;
-	    
-	    /* ADDED: cgw
-	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
-	     */
-	    oldsize = trace->block_sizes[index];
-	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
-		return 0;
-	      }
-	    }
-	    memset(newp, index & 0xFF, size);
-
-	    /* Remember region */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = size;
-	    break;
-
-        case FREE: /* mm_free */
-	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
-	    break;
-
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
-
-    }
-
-    /* As far as we know, this is a valid malloc package */
-    return 1;
-}
-
-/* 
- * eval_mm_util - Evaluate the space utilization of the student's package
- *   The idea is to remember the high water mark "hwm" of the heap for 
- *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
- */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
-{   
-    int i;
-    int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
-    char *p;
-    char *newp, *oldp;
-
-    /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
-	app_error("mm_init failed in eval_mm_util");
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-
-	    if ((p = (char *) mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
-	    
-	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += size;
-	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
-	    break;
-
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldsize = trace->block_sizes[index];
-
-	    oldp = trace->blocks[index];
-	    if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc failed in eval_mm_util");
-
-	    /* Remember region and size */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = newsize;
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += (newsize - oldsize);
-	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
-	    break;
-
-        case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
-	    
-	    mm_free(p);
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size -= size;
-	    
-	    break;
-
-	default:
-	    app_error("Nonexistent request type in eval_mm_util");
-
-        }
-    }
-
-    return ((double)max_total_size / (double)mem_heapsize());
-}
-
-
-/*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
- */
-static void eval_mm_speed(void *ptr)
-{
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
-	app_error("mm_init failed in eval_mm_speed");
-
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = (char *) mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
-
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-            if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
-
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
-
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
-}
-
-/*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
- */
-static int eval_libc_valid(trace_t *trace, int tracenum)
-{
-    int i, newsize;
-    char *p, *newp, *oldp;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* malloc */
-	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
-
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
-	    break;
-
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
-	}
-    }
-
-    return 1;
-}
-
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
- */
-static void eval_libc_speed(void *ptr)
-{
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = (char *) malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
-
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
-	}
-    }
-}
-
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -987,6 +457,140 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printrealloc - prints how many payload bytes mm_realloc moved by
+ *     copying and by remapping pages, and how many calls -u avoided,
+ *     for each trace that reallocs
+ */
+static void printrealloc(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%14s%14s%10s\n", "trace", "copied", "remapped", "avoided");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && (stats[i].realloc.bytes_copied ||
+			       stats[i].realloc.bytes_remapped ||
+			       stats[i].avoided))
+	    printf("%2d%17lu%14lu%10d\n",
+		   i,
+		   stats[i].realloc.bytes_copied,
+		   stats[i].realloc.bytes_remapped,
+		   stats[i].avoided);
+    }
+}
+
+/*
+ * printhint - prints the throughput of the startup requests and of the
+ *     rest of each trace, timed apart within the same replays, with the
+ *     heap started by mm_init and by mm_init_hint with the trace's size
+ *     hint
+ */
+static void printhint(int n, stats_t *stats)
+{
+    int i, j, start;
+    double kops[2][2];
+
+    printf("%5s%21s%21s   (Kops)\n", "trace", "startup", "steady state");
+    printf("%5s%11s%10s%11s%10s\n", "", "mm_init", "hint", "mm_init", "hint");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	/* As mmb_split_secs takes it, at least the first request */
+	start = (int)stats[i].ops / STARTUP_SHARE;
+	if (start < 1)
+	    start = 1;
+	for (j = 0; j < 2; j++) {
+	    kops[j][0] = start / stats[i].hint_secs[j][0] / 1e3;
+	    kops[j][1] = (stats[i].ops - start) / stats[i].hint_secs[j][1] / 1e3;
+	}
+	printf("%2d%14.0f%10.0f%11.0f%10.0f\n",
+	       i, kops[0][0], kops[1][0], kops[0][1], kops[1][1]);
+    }
+}
+
+/*
+ * printminheap - prints the smallest heap each trace ran in, next to
+ *     the peak heap it reached without a limit, and the throughput with
+ *     no limit and with the limit at tight_pct of that minimum
+ */
+static void printminheap(int n, stats_t *stats)
+{
+    int i, j;
+
+    printf("%5s%12s%12s%8s%8s", "trace", "peak heap", "min heap", "min%", "Kops");
+    for (j = 0; j < NTIGHT; j++)
+	printf("%6d%%", tight_pct[j]);
+    printf("   (Kops at the limit)\n");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%15lu%12lu%7.0f%%%8.0f", i,
+	       (unsigned long)stats[i].peak_heap,
+	       (unsigned long)stats[i].min_heap,
+	       100.0 * stats[i].min_heap / stats[i].peak_heap,
+	       stats[i].ops / stats[i].secs / 1e3);
+	for (j = 0; j < NTIGHT; j++) {
+	    if (stats[i].tight_secs[j] > 0)
+		printf("%7.0f", stats[i].ops / stats[i].tight_secs[j] / 1e3);
+	    else
+		printf("%7s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * asked_size - Where -u keeps the size last asked for with payload ptr,
+ *     or NULL for a payload outside the heap (a guarded block)
+ */
+static uint32_t *asked_size(void *ptr)
+{
+    char *lo = mem_heap_lo();
+
+    if ((char *)ptr < lo || (char *)ptr >= lo + MAX_HEAP)
+	return NULL;
+    return &asked_sizes[((char *)ptr - lo) / ALIGNMENT];
+}
+
+/*
+ * mm_malloc_usable - mm_malloc for -u, noting the size asked for as a
+ *     caller that tracks its buffers' lengths would
+ */
+static void *mm_malloc_usable(uint32_t size)
+{
+    void *p = mm_malloc(size);
+    uint32_t *asked;
+
+    if (p != NULL && (asked = asked_size(p)) != NULL)
+	*asked = size;
+    return p;
+}
+
+/*
+ * mm_realloc_usable - mm_realloc as a caller that sizes its buffers with
+ *     mm_malloc_usable_size would use it: a request the block can
+ *     already hold keeps the block and makes no call. Only a request
+ *     that grows into the block's slack counts as avoided; a shrink
+ *     would not have moved the block anyway
+ */
+static void *mm_realloc_usable(void *ptr, uint32_t size)
+{
+    uint32_t *asked = asked_size(ptr);
+    void *newp;
+
+    if (size <= mm_malloc_usable_size(ptr)) {
+	if (asked != NULL && size > *asked)
+	    reallocs_avoided++;
+    }
+    else if ((newp = mm_realloc(ptr, size)) == NULL)
+	return NULL;
+    else
+	ptr = newp;
+    if ((asked = asked_size(ptr)) != NULL)
+	*asked = size;
+    return ptr;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -996,6 +600,26 @@ void app_error(const char *msg)
     exit(1);
 }
 
+/*
+ * dump_heap - Replay the trace up to its peak payload and write an
+ *     mm_dump snapshot of the heap there to <dir>/<trace>.dmp
+ */
+static void dump_heap(mmb_trace_t *trace, const char *dir, const char *tracefile)
+{
+    mmb_opts_t opts;
+    char path[MAXLINE];
+    const char *name = strrchr(tracefile, '/');
+
+    memset(&opts, 0, sizeof(opts));
+    opts.nops = mmb_peak_op(trace) + 1;
+    snprintf(path, sizeof(path), "%s/%s.dmp", dir, name ? name + 1 : tracefile);
+    if (mmb_util(&mm_alloc, trace, &opts) < 0 || mm_dump(path) < 0)
+	printf("Could not dump the heap of %s to %s: %s\n", tracefile, path,
+	       strerror(errno));
+    else if (verbose > 1)
+	printf("Dumped the heap at request %d to %s\n", opts.nops - 1, path);
+}
+
 /* 
  * unix_error - Report a Unix-style error
  */
@@ -1005,28 +629,26 @@ void unix_error(const char *msg)
     exit(1);
 }
 
-/*
- * malloc_error - Report an error returned by the mm_malloc package
- */
-void malloc_error(int tracenum, int opnum, const char *msg)
-{
-    errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
-}
-
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValFuHM] [-D <dir>] [-f <file>] [-G <n>] [-k <k>] [-t <dir>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-D <dir>   Dump the heap at each trace's peak to <dir>/<trace>.dmp.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Replay frees with mm_free_async.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G <n>     Put one request in <n> in a guarded slot.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Also time startup and steady state with mm_init_hint.\n");
+    fprintf(stderr, "\t-k <k>     Take the tightest of the first <k> fits (0 = adaptive,\n\t           -1 = address-ordered first fit).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M         Find the smallest heap each trace runs in, and time it there.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-u         Skip reallocs that fit the block's usable size.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -17,6 +17,7 @@
 /* private variables */
 char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
+static char *mem_peak_brk;   /* highest value mem_brk has reached */
 static char *mem_max_addr;   /* largest legal heap address */ 
 
 /* 
@@ -24,14 +25,21 @@ static char *mem_max_addr;   /* largest legal heap address */
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* 
+     * reserve the storage we will use to model the available VM. It is
+     * mapped rather than malloc'ed so the mm package can madvise, mprotect
+     * and mremap whole pages of it.
+     */
+    mem_start_brk = (char *)mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak_brk = mem_start_brk;
 }
 
 /* 
@@ -39,7 +47,18 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, MAX_HEAP);
+}
+
+/*
+ * mem_set_max - cap the heap at bytes (0 or anything past MAX_HEAP
+ *    means MAX_HEAP). mem_sbrk fails with ENOMEM beyond the cap
+ */
+void mem_set_max(size_t bytes)
+{
+    if (bytes == 0 || bytes > MAX_HEAP)
+	bytes = MAX_HEAP;
+    mem_max_addr = mem_start_brk + bytes;
 }
 
 /*
@@ -48,23 +67,31 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, but never below its start.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0) && ((mem_brk + incr) < mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Heap cannot shrink that far...\n");
+	return (void *)-1;
+    }
+    /* Running out is reported through errno only; mm decides what to do */
+    if ((mem_brk + incr) > mem_max_addr) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_peak_brk)
+	mem_peak_brk = mem_brk;
     return (void *)old_brk;
 }
 
@@ -92,6 +119,16 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest size the heap has had since
+ *    the last mem_reset_brk, which is what the heap cost even if it
+ *    was later shrunk
+ */
+size_t mem_peak_heapsize()
+{
+    return (size_t)(mem_peak_brk - mem_start_brk);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -2,10 +2,12 @@
 
 void mem_init(void);               
 void mem_deinit(void);
+void mem_set_max(size_t bytes);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
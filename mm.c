@@ -1,16 +1,25 @@
 /* 
  * mm-implicit.c -  Simple allocator based on implicit free lists, 
  *                  first fit placement, and boundary tag coalescing. 
+ *                  (Placement is next fit by default, or bounded good
+ *                  fit or address-ordered first fit with mm_set_fit.
+ *                  Free blocks are also kept on an address-ordered
+ *                  list, linked through their first payload words.)
  *
  * Each block has header and footer of the form:
  * 
  *      31                     3  2  1  0 
  *      -----------------------------------
- *     | s  s  s  s  ... s  s  s  0  0  a/f
+ *     | s  s  s  s  ... s  s  s  r  p  a/f
  *      ----------------------------------- 
  * 
  * where s are the meaningful size bits and a/f is set 
- * iff the block is allocated. The list has the following form:
+ * iff the block is allocated. p marks a free block whose interior
+ * pages have been purged, or an allocated block that goes back to its
+ * small-class stack when freed, and r an allocated block carved from a
+ * thread-owned run (whose footer then holds the run's offset instead).
+ * On an allocated block, r and p together are its free route.
+ * The list has the following form:
  *
  * begin                                                          end
  * heap                                                           heap  
@@ -23,10 +32,16 @@
  * The allocated prologue and epilogue blocks are overhead that
  * eliminate edge conditions during coalescing.
  */
+#define _GNU_SOURCE         /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include "mm.h"
 #include "memlib.h"
 
@@ -59,6 +74,33 @@ team_t team = {
 #define DSIZE       8       /* doubleword size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
+#define SMALL_MAX   MM_SMALL_MAX  /* largest asize served by the small-class stacks */
+#define NSMALL      (SMALL_MAX/DSIZE + 1)  /* stacks indexed by asize/DSIZE */
+#define SMALL_CAP   32      /* most blocks a single stack will hold */
+#define DEFER_KICK  256     /* deferred frees that wake the maintenance thread */
+#define PURGE_MIN  (1<<14)  /* smallest free block whose pages are purged */
+#define TRIM_MIN   (2*CHUNKSIZE)  /* wilderness size that triggers a trim */
+#define PURGED      0x2     /* free block whose interior pages are purged */
+#define ASYNC_BATCH 256     /* frees buffered per thread by mm_free_async */
+#define LINE        64      /* cache line size (bytes) */
+#define RUN_BYTES  (1<<12)  /* block area of a thread-owned run */
+#define RUN         0x4     /* allocated block carved from a thread-owned run */
+#define SMALL       0x2     /* allocated block freed to its small-class stack */
+#define ROUTE      (RUN | SMALL)  /* where mm_free sends an allocated block */
+#define MAX_THREADS 256     /* threads that can use mm_epoch_enter at once */
+#define RETIRE_BATCH 64     /* retires between attempts to advance the epoch */
+#define MAX_PRESSURE 8      /* pressure callbacks that can be registered */
+#define GUARD_SLOTS 16      /* sampled allocations that can be live at once */
+#define REMAP_MIN  (1<<16)  /* smallest realloc copy done with mremap */
+#define REMAP_SPLITS 64     /* most remapped ranges splitting the heap mapping */
+#define MAX_REQUEST (UINT32_MAX - 2*DSIZE)  /* largest size ASIZE takes without wrapping */
+#define FIT_KMAX   64       /* most candidates an adaptive search looks at */
+#define FIT_SCAN    8       /* free blocks walked per candidate after the first */
+#define INSERT_WALK 16      /* tag steps each way to place a free block */
+#define SIDE_SHIFT 16     /* log2 of the heap chunk one side entry covers */
+#define SPLIT_DEFAULT 16    /* smallest remainder split off before any demand is seen */
+#define SPLIT_WINDOW 512    /* heap requests between split_min updates */
+#define SPLIT_SHARE  32     /* a class is in demand at 1/SPLIT_SHARE of them */
 
 static inline int MAX(int x, int y) {
   return x > y ? x : y;
@@ -122,6 +164,242 @@ static inline void* PREV_BLKP(void *bp){
 
 static char *heap_listp;  /* pointer to first block */  
 static char *next_fit;	  // Global placeholder for nextfit search
+static char *free_list;   // lowest free block; free blocks are linked in address order
+
+//
+// Side table of free-block search metadata, one entry per heap chunk of
+// 1<<SIDE_SHIFT bytes: the lowest free block that starts in the chunk,
+// and an upper bound on the size of any free block that starts there.
+// find_fit scans it to skip chunks whose blocks are all too small, so
+// it touches one dense array instead of a cold header per candidate.
+// The bound only grows as blocks are added and is pulled back down
+// when a search has seen every block of the chunk. Guarded by heap_lock
+//
+// The free list's own metadata stays in band on purpose: each free
+// block keeps its size in its boundary tags and its list links in its
+// first payload words. coalesce and place rewrite those words anyway.
+// Moving them here would need an entry per block, not per chunk, kept
+// in step on every split and merge. The table only has to be good
+// enough to skip chunks, so two words per chunk do.
+//
+typedef struct {
+  uint32_t max;             // no free block starting here is larger
+  uint32_t first;           // offset of the lowest one (0 = none)
+} side_t;
+
+static side_t *side;      // mapped once, covering every 32-bit offset
+static uint32_t side_top; // entries below this may be in use
+
+//
+// Placement policy (see mm_set_fit): find_fit takes the tightest of the
+// first fit_k fits from next_fit, or of the first fit_adapt fits if
+// fit_k is MM_FIT_ADAPTIVE, or the lowest fit if fit_k is
+// MM_FIT_ADDRESS. Both are guarded by heap_lock
+//
+static int fit_k = 1;
+static int fit_adapt = 1;
+
+//
+// Adaptive split threshold (see split_note). place only splits off a
+// remainder of at least split_min bytes; a smaller one is a splinter
+// that no request in sight would reuse, and stays inside the block.
+// All three are guarded by heap_lock
+//
+static uint32_t split_min = SPLIT_DEFAULT;
+static unsigned int split_demand[NSMALL + 1];  // [NSMALL] = larger requests
+static unsigned int split_count;
+
+//
+// The boundary-tag heap (heap_listp, next_fit and every header/footer)
+// is only touched with heap_lock held.
+//
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Small-class free stacks
+//
+// Freed blocks with asize <= SMALL_MAX are pushed on a per-size stack
+// instead of going back to the heap. They keep their allocated
+// header/footer, so coalesce never sees them. The link to the next
+// block is a 32-bit heap offset stored in the first payload word.
+//
+// In MM_SMALL_LOCKFREE mode each stack is a Treiber stack whose head
+// packs that offset with a 32-bit version tag into one 64-bit word, so
+// a pop that races with a pop/push/pop of the same block fails its CAS
+// instead of installing a stale link (ABA). In MM_SMALL_LOCKED mode the
+// same lists are guarded by a mutex per class instead.
+//
+typedef struct {
+  _Atomic uint64_t head;   // tag << 32 | offset of top block (0 = empty)
+  atomic_int count;        // approximate number of blocks on the stack
+} block_stack_t;
+
+static block_stack_t small_stacks[NSMALL];
+static pthread_mutex_t small_locks[NSMALL];  // MM_SMALL_LOCKED mode only
+static char *heap_base;            // offsets in the stacks are from here
+static int small_mode = MM_SMALL_LOCKFREE;
+static int small_refill = 1;       // blocks carved from the heap per miss
+
+//
+// Background maintenance state (see mm_maint_start)
+//
+static block_stack_t deferred;        // frees waiting for the thread
+static atomic_int maint_running;      // mm_free defers while this is set
+static pthread_t maint_tid;
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static int maint_stop_req;            // guarded by maint_lock
+static int maint_kicked;              // guarded by maint_lock
+static unsigned int maint_period_ms;
+static mm_maint_stats_t maint_stats;  // guarded by heap_lock
+
+//
+// Thread-owned runs (MM_SMALL_RUNS mode)
+//
+// A run is a heap block holding a run_t in its first cache line and a
+// line-aligned area of RUN_BYTES from which blocks of one size class
+// are carved for a single owning thread. The area shares no line with
+// any other block, so small objects of different threads never share
+// a line. A carved block has RUN set in its header and the offset of
+// its run_t in its footer; frees from any thread push it back on the
+// run's own stack, and only the owner pops from there.
+//
+typedef struct {
+  uint32_t link;           // next run on an abandoned stack
+  uint32_t asize;          // size of every block in the run
+  block_stack_t free;      // freed blocks, pushed by any thread
+  uint32_t next;           // owner's next run of this class
+  uint32_t bump;           // offset of the next uncarved header
+  uint32_t end;            // offset of the end of the block area
+} run_t;
+
+static block_stack_t abandoned[NSMALL];   // runs of exited threads
+
+//
+// Epoch-based reclamation (see mm_retire)
+//
+// Each thread inside an epoch section has a record in epoch_recs with
+// the global epoch it saw on entry. The global epoch moves from e to
+// e+1 only once every active record has seen e, so a block retired in
+// epoch e can no longer be reached by anybody once the epoch reaches
+// e+2. Records are padded to a cache line so entering and leaving do
+// not bounce lines between threads.
+//
+typedef struct {
+  atomic_uint epoch;       // global epoch seen by the last enter
+  atomic_int active;       // inside mm_epoch_enter/mm_epoch_exit
+  atomic_int in_use;       // slot claimed by a thread
+  char pad[LINE - 3*sizeof(int)];
+} epoch_rec_t;
+
+//
+// A retired block may still be read by threads inside a section, so it
+// is not written until it is freed. The blocks a thread retires in an
+// epoch are listed in batches, each a heap block of its own, and the
+// batches of an epoch are chained from newest to oldest.
+//
+typedef struct {
+  uint32_t next;           // older batch of the same epoch (0 = none)
+  unsigned int epoch;      // global_epoch its blocks were retired in
+  uint32_t n;              // blocks listed
+  uint32_t bp[RETIRE_BATCH];  // their offsets
+} retire_batch_t;
+
+static epoch_rec_t epoch_recs[MAX_THREADS];
+static atomic_int epoch_nrecs;        // slots ever claimed on this heap
+static atomic_uint global_epoch;
+static block_stack_t orphans;         // retire batches of exited threads
+
+//
+// Memory budget (see mm_set_limit). Both are guarded by heap_lock
+//
+static size_t heap_limit;             // most bytes the heap may span (0 = none)
+static struct {
+  mm_pressure_fn fn;
+  void *arg;
+} pressure_cbs[MAX_PRESSURE];
+
+//
+// Sampled guarded allocations (see mm_set_guard_rate). The pool is a
+// mapping of its own, outside the heap, laid out as page-aligned
+// [guard][slot][guard][slot]...[guard] pages. It is all PROT_NONE when
+// mapped, so it costs no memory until a slot page is first used; the
+// page of a slot whose block has been freed is PROT_NONE again until
+// the slot is reused.
+//
+typedef struct {
+  char *bp;                // block in the slot (NULL = never used)
+  uint32_t size;           // bytes requested
+  int live;                // allocated, as opposed to quarantined
+  int retired;             // live, but passed to mm_retire
+  unsigned int retire_epoch;  // global_epoch when it was retired
+  unsigned long freed;     // guard_clock when it was freed
+} guard_slot_t;
+
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int guard_rate;       // sample 1 in guard_rate (0 = off)
+static __thread unsigned int guard_countdown;
+static __thread int guard_seeded;     // guard_countdown has been set
+static atomic_uint guard_threads;     // threads that have seeded it
+static char *guard_pool;              // first guard page, or NULL
+static size_t guard_page;             // page size of the pool
+static guard_slot_t guard_slots[GUARD_SLOTS];
+static unsigned long guard_clock;
+static atomic_int guard_nretired;     // slots waiting out their epoch
+static struct sigaction guard_oldsa;  // SIGSEGV handler we replaced
+
+//
+// Bytes mm_realloc has moved, by memcpy or by mremap (mm_realloc_stats)
+//
+static atomic_ulong realloc_copied;
+static atomic_ulong realloc_remapped;
+
+//
+// Page ranges move_payload has moved into the heap. Each one carries its
+// old place in the address space with it, so the kernel keeps it as a
+// mapping of its own, splitting the heap's. When a free takes in the
+// whole range it is mapped afresh, which joins it to the heap again.
+// While REMAP_SPLITS ranges are outstanding move_payload copies instead.
+// Guarded by heap_lock
+//
+static struct { uintptr_t lo, hi; } remap_splits[REMAP_SPLITS];  // hi 0 = unused
+static int remap_nsplits;             // claimed, moved in or about to be
+
+//
+// Fork sealing (see mm_set_fork_seal). heap_floor is the lowest block
+// the heap may list or merge into: the first block after the prologue,
+// or in a sealed child the first block past the parent's heap. Blocks
+// below it are never written again; freeing one sets its bit in
+// seal_map, one bit per doubleword of the sealed heap
+//
+static int fork_seal;                 // seal the heap in forked children
+static pthread_once_t seal_once = PTHREAD_ONCE_INIT;
+static char *heap_floor;
+static atomic_ulong *seal_map;        // NULL = heap not sealed
+static size_t seal_map_bytes;
+
+//
+// Per-thread state: the buffer of mm_free_async pointers and the runs
+// the thread owns. gen is the heap generation it belongs to; state
+// left over from before the last mm_init is dropped rather than used
+// on the new heap.
+//
+typedef struct {
+  void *async[ASYNC_BATCH];
+  int nasync;
+  uint32_t runs[NSMALL];   // owned runs per class, most recent first
+  int epoch_rec;           // index + 1 of our epoch record (0 = none)
+  int epoch_depth;         // nesting of mm_epoch_enter
+  uint32_t retired[3];     // chains of retire batches, by epoch % 3
+  unsigned int retired_epoch[3];
+  int nretired;            // retires since the last advance attempt
+  unsigned int gen;
+} thread_state_t;
+
+static __thread thread_state_t thread_state;
+static atomic_uint heap_gen;          // bumped by every mm_init
+static pthread_key_t thread_key;      // cleans up thread_state at exit
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
 
 //
 // function prototypes for internal helper routines
@@ -130,8 +408,146 @@ static void *extend_heap(uint32_t words);
 static void place(void *bp, uint32_t asize);
 static void *find_fit(uint32_t asize);
 static void *coalesce(void *bp);
+static void free_link(void *bp, void *pred);
+static void free_unlink(void *bp);
+static void free_insert(void *bp);
+static void *side_next(uint32_t c, uint32_t asize);
+static void split_note(uint32_t asize);
 static void printblock(void *bp); 
 static void checkblock(void *bp);
+static void *heap_malloc(uint32_t asize);
+static void heap_free(void *bp);
+static void *stack_pop(block_stack_t *st);
+static void stack_push(block_stack_t *st, void *bp);
+static void *stack_take(block_stack_t *st);
+static void *small_pop(int cls);
+static int small_push(int cls, void *bp);
+static int small_cache(void *bp);
+static int drain_deferred(void);
+static void maint_pass(void);
+static void *maint_main(void *arg);
+static void *sort_chain(void *bp);
+static void async_flush(thread_state_t *ts);
+static thread_state_t *my_state(void);
+static void *run_malloc(uint32_t asize);
+static run_t *run_new(uint32_t asize);
+static void run_free(void *bp);
+static void release(void *bp);
+static void free_chain(void *bp);
+static void epoch_advance(void);
+static void epoch_reclaim(thread_state_t *ts);
+static void retire_free(retire_batch_t *b);
+static void trim_heap(void);
+static void purge_heap(void);
+static void *heap_reclaim(uint32_t asize);
+static int free_special(void *bp);
+static inline int guard_sample(void);
+static void *guard_malloc(uint32_t size);
+static void guard_free(void *bp);
+static void guard_retire(void *bp, unsigned int e);
+static void guard_reclaim(unsigned int e);
+static void guard_reset(void);
+static void guard_unhook(void);
+static char *guard_puts(char *p, char *end, const char *s);
+static char *guard_putu(char *p, char *end, uintptr_t v, int base);
+static void *heap_resize(void *bp, uint32_t asize, int move);
+static void *heap_malloc_congruent(uint32_t asize, void *ptr);
+static void move_payload(void *dst, void *src, uint32_t n);
+static int remap_claim(void);
+static void remap_record(uintptr_t lo, uintptr_t hi);
+static void remap_reclaim(char *lo, char *hi);
+static void remap_fresh(uintptr_t lo, uintptr_t hi);
+static void seal_free(void *bp);
+
+//
+// Convert between block pointers and the 32-bit offsets kept in the stacks
+//
+static inline uint32_t OFFSET(void *bp) {
+  return (uint32_t)((char *)bp - heap_base);
+}
+static inline void *OFFSET_PTR(uint32_t off) {
+  return off ? heap_base + off : NULL;
+}
+static inline uint64_t STACK_HEAD(uint32_t off, uint32_t tag) {
+  return ((uint64_t)tag << 32) | off;
+}
+static inline void *STACK_NEXT(void *bp) {
+  return OFFSET_PTR(*(uint32_t *)bp);
+}
+
+//
+// Links of a free block on free_list: offsets of its predecessor and
+// successor in the first two payload words (0 = none)
+//
+static inline void *FREE_PRED(void *bp) {
+  return OFFSET_PTR(((uint32_t *)bp)[0]);
+}
+static inline void *FREE_SUCC(void *bp) {
+  return OFFSET_PTR(((uint32_t *)bp)[1]);
+}
+static inline void SET_PRED(void *bp, void *pred) {
+  ((uint32_t *)bp)[0] = pred ? OFFSET(pred) : 0;
+}
+static inline void SET_SUCC(void *bp, void *succ) {
+  ((uint32_t *)bp)[1] = succ ? OFFSET(succ) : 0;
+}
+
+//
+// Side table entry of the chunk free block bp starts in, and the
+// number of chunks the heap spans
+//
+static inline uint32_t CHUNK(void *bp) {
+  return OFFSET(bp) >> SIDE_SHIFT;
+}
+static inline uint32_t NCHUNKS(void) {
+  return (uint32_t)((mem_heapsize() + (1 << SIDE_SHIFT) - 1) >> SIDE_SHIFT);
+}
+
+//
+// Raise the size bound of free block bp's chunk to cover bp
+//
+static inline void SIDE_NOTE(void *bp) {
+  side_t *e = &side[CHUNK(bp)];
+  if (e->max < GET_SIZE(HDRP(bp))){
+    e->max = GET_SIZE(HDRP(bp));
+  }
+}
+
+//
+// Adjusted block size for a request of size bytes: room for the header
+// and footer, rounded up to a doubleword
+//
+static inline uint32_t ASIZE(uint32_t size) {
+  if (size <= DSIZE){
+    return 2*DSIZE;
+  }
+  return DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+}
+
+//
+// Mark allocated block bp as one mm_free pushes on its small-class stack
+//
+static inline void SET_SMALL(void *bp) {
+  PUT(HDRP(bp), GET(HDRP(bp)) | SMALL);
+  PUT(FTRP(bp), GET(FTRP(bp)) | SMALL);
+}
+
+//
+// Is bp a sampled guarded block? Told apart by address, since a freed
+// one's header is no longer readable and a double free must not fault
+//
+static inline int IS_GUARDED(void *bp) {
+  return guard_pool != NULL && (char *)bp > guard_pool &&
+         (char *)bp < guard_pool + (2*GUARD_SLOTS + 1) * guard_page;
+}
+
+//
+// Is bp a block of the parent's heap in a sealed child. The lower bound
+// matters: the guarded pool may be mapped below the heap
+//
+static inline int IS_SEALED(void *bp) {
+  return (char *)bp >= heap_base && (char *)bp < heap_floor;
+}
 
 //
 // mm_init - Initialize the memory manager 
@@ -140,6 +556,62 @@ static void checkblock(void *bp);
 // page 858.
 int mm_init(void) 
 {
+  int i;
+
+  // The old guarded pool has protected pages that the new heap reuses
+  guard_reset();
+
+  // Rejoin what move_payload split off the old heap's mapping, if the new
+  // heap is laid out in the same one
+  if (heap_base != NULL && heap_base == mem_heap_lo()){
+    remap_reclaim(heap_base, (char *)UINTPTR_MAX);
+  }
+  memset(remap_splits, 0, sizeof(remap_splits));
+  remap_nsplits = 0;
+
+  // Forget any blocks cached from the previous heap
+  for (i = 0; i < NSMALL; i++){
+    atomic_store(&small_stacks[i].head, 0);
+    atomic_store(&small_stacks[i].count, 0);
+    atomic_store(&abandoned[i].head, 0);
+    atomic_store(&abandoned[i].count, 0);
+    pthread_mutex_init(&small_locks[i], NULL);
+  }
+  atomic_store(&deferred.head, 0);
+  atomic_store(&deferred.count, 0);
+  atomic_store(&orphans.head, 0);
+  atomic_store(&orphans.count, 0);
+  memset(epoch_recs, 0, sizeof(epoch_recs));
+  atomic_store(&epoch_nrecs, 0);
+  atomic_store(&global_epoch, 0);
+  memset(&maint_stats, 0, sizeof(maint_stats));
+  atomic_store(&realloc_copied, 0);
+  atomic_store(&realloc_remapped, 0);
+  atomic_fetch_add(&heap_gen, 1);
+  heap_base = mem_heap_lo();
+  fit_adapt = 1;
+  free_list = NULL;
+  if (seal_map != NULL){
+    munmap(seal_map, seal_map_bytes);
+    seal_map = NULL;
+  }
+
+  // The side table is mapped once and only touched where the heap is
+  if (side == NULL){
+    side = mmap(NULL, ((size_t)1 << (32 - SIDE_SHIFT)) * sizeof(side_t),
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (side == MAP_FAILED){
+      side = NULL;
+      return -1;
+    }
+  }
+  memset(side, 0, side_top * sizeof(side_t));
+  side_top = 0;
+  split_min = SPLIT_DEFAULT;
+  memset(split_demand, 0, sizeof(split_demand));
+  split_count = 0;
+
   // Creates a heap size 16 bytes to fit four words
   // heap_listp contains address of starting point
   if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *) -1){
@@ -157,6 +629,7 @@ int mm_init(void)
 
   // Move between header and footer
   heap_listp += (2*WSIZE);
+  heap_floor = heap_listp;
   // Move next_fit spot to beginning of heap
   next_fit = heap_listp;
 
@@ -168,6 +641,70 @@ int mm_init(void)
   return 0;
 }
 
+//
+// mm_init_hint - mm_init for a program that knows roughly what it will
+//                ask for: expected_bytes of heap in all, and hist[c]
+//                requests of small class c (MM_CLASS in mm.h; NULL if
+//                unknown)
+//
+// The heap is grown to expected_bytes (within the budget) with one
+// mem_sbrk instead of CHUNKSIZE at a time, and each hinted class gets
+// its stack filled up to SMALL_CAP blocks, or in MM_SMALL_RUNS mode a
+// run for the calling thread, before the first request.
+//
+int mm_init_hint(size_t expected_bytes, const uint32_t *hist)
+{
+  thread_state_t *ts;
+  run_t *run;
+  char *bp;
+  uint32_t n;
+  int cls;
+
+  if (mm_init() < 0){
+    return -1;
+  }
+  if (heap_limit && expected_bytes > heap_limit){
+    expected_bytes = heap_limit;
+  }
+  if (expected_bytes > mem_heapsize()){
+    extend_heap((expected_bytes - mem_heapsize()) / WSIZE);
+  }
+  if (hist == NULL || small_mode == MM_SMALL_OFF){
+    return 0;
+  }
+
+  for (cls = 2; cls < NSMALL; cls++){
+    if (hist[cls] == 0){
+      continue;
+    }
+    if (small_mode == MM_SMALL_RUNS){
+      if ((run = run_new(cls * DSIZE)) != NULL){
+        ts = my_state();
+        run->next = ts->runs[cls];
+        ts->runs[cls] = OFFSET(run);
+      }
+      continue;
+    }
+    pthread_mutex_lock(&heap_lock);
+    for (n = 0; n < hist[cls] && n < SMALL_CAP; n++){
+      if ((bp = heap_malloc(cls * DSIZE)) == NULL){
+        break;
+      }
+      if (GET_SIZE(HDRP(bp)) > SMALL_MAX){
+        heap_free(bp);
+        break;
+      }
+      SET_SMALL(bp);
+      if (!small_push(GET_SIZE(HDRP(bp))/DSIZE, bp)){
+        heap_free(bp);
+        break;
+      }
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+  return 0;
+}
+
 
 //
 // extend_heap - Extend heap with free block and return its block pointer
@@ -181,6 +718,10 @@ static void *extend_heap(uint32_t words)
 
   // Make sure the number of words is always even to maintain alignment
   size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  // and that the new free block has room for its free list links
+  if (size < 2*DSIZE){
+    size = 2*DSIZE;
+  }
 
 
   // If there is space, extend the heap by 'size'
@@ -208,39 +749,227 @@ static void *extend_heap(uint32_t words)
 // page 884.
 static void *find_fit(uint32_t asize)
 {
-  // Assigns beginning of the search to the next_fit pointer
-  char *bp = next_fit;
+  char *start, *bp, *best = NULL;
+  int k = fit_k == MM_FIT_ADAPTIVE ? fit_adapt : fit_k;
+  int seen = 0, budget = 0, wrapped = 0, whole = 0;
+  uint32_t size, c, cur = UINT32_MAX, cmax = 0;
 
-  // Search from next_fit to the end of the heap
-  for (next_fit = bp; GET_SIZE(HDRP(next_fit)) > 0; next_fit = NEXT_BLKP(next_fit)){
-    if(!GET_ALLOC(HDRP(next_fit)) && (asize <= GET_SIZE(HDRP(next_fit)))){
-      // If a fit is found, return the address the of block pointer
-      return next_fit;
+  // Address-ordered first fit starts from the lowest free block. The
+  // other policies start from the first free block at or after the
+  // next_fit rover, or from the lowest one if there is none
+  if (fit_k == MM_FIT_ADDRESS){
+    start = free_list;
+    k = 1;
+  }
+  else {
+    start = next_fit;
+    while (GET_SIZE(HDRP(start)) > 0 && GET_ALLOC(HDRP(start))){
+      start = NEXT_BLKP(start);
+    }
+    if (GET_SIZE(HDRP(start)) == 0){
+      start = free_list;
     }
   }
 
-  // If no fit is found by the end of the heap, start the search from the
-  // beginning of the heap to the original next_fit location
-  for (next_fit = heap_listp; next_fit < bp; next_fit = NEXT_BLKP(next_fit)){
-    if(!GET_ALLOC(HDRP(next_fit)) && (asize <= GET_SIZE(HDRP(next_fit)))){
-      return next_fit;
+  // Search the free list from there to its end, then (except for first
+  // fit) from its head back up to the start, until k fits have been
+  // seen or one fits exactly. Once there is a fit, only k*FIT_SCAN more
+  // free blocks are walked looking for a better one. Chunks whose size
+  // bound is below asize are skipped through the side table
+  for (bp = start; ; ){
+    if (bp == NULL || (wrapped && bp >= start)){
+      if (wrapped || fit_k == MM_FIT_ADDRESS || start == free_list){
+        break;
+      }
+      wrapped = 1;
+      bp = free_list;
+      continue;
+    }
+    c = CHUNK(bp);
+    if (side[c].max < asize){
+      bp = side_next(c + 1, asize);
+      continue;
+    }
+    if (c != cur){
+      cur = c;
+      cmax = 0;
+      whole = OFFSET(bp) == side[c].first;
+    }
+
+    size = GET_SIZE(HDRP(bp));
+    if (size > cmax){
+      cmax = size;
+    }
+    if (asize <= size){
+      if (best == NULL || size < GET_SIZE(HDRP(best))){
+        best = bp;
+      }
+      if (++seen == k || size - asize < split_min){
+        break;
+      }
+    }
+    if (best != NULL && ++budget > k*FIT_SCAN){
+      break;
+    }
+
+    // Having seen every block that starts in the chunk, tighten its bound
+    bp = FREE_SUCC(bp);
+    if (whole && (bp == NULL || CHUNK(bp) != c)){
+      side[c].max = cmax;
     }
   }
 
   // If no fit is found, return NULL
-  return NULL;
+  if (best == NULL){
+    return NULL;
+  }
+
+  // Adaptive: look further while fits leave large splinters behind,
+  // and less far once they are tight
+  if (fit_k == MM_FIT_ADAPTIVE){
+    size = GET_SIZE(HDRP(best)) - asize;
+    if (size >= asize && fit_adapt < FIT_KMAX){
+      fit_adapt *= 2;
+    }
+    else if (size < 2*DSIZE && fit_adapt > 1){
+      fit_adapt /= 2;
+    }
+  }
+
+  // The next search starts from the block that was taken
+  next_fit = best;
+  return best;
+}
+
+//
+// mm_malloc_class - mm_malloc for a request of class cls (MM_CLASS in
+//                   mm.h), for callers that know it at compile time
+//
+// The class stack or run is used directly when there is nothing else
+// mm_malloc would do first; otherwise this is mm_malloc.
+//
+void *mm_malloc_class(int cls)
+{
+  char *bp;
+
+  if (thread_state.nasync == 0 && guard_rate == 0){
+    if (small_mode == MM_SMALL_RUNS){
+      return run_malloc(cls * DSIZE);
+    }
+    if (small_mode != MM_SMALL_OFF && (bp = small_pop(cls)) != NULL){
+      return bp;
+    }
+  }
+  return mm_malloc(cls * DSIZE - OVERHEAD);
+}
+
+//
+// mm_free_class - mm_free for a block allocated with class cls
+//
+// The block goes on the cls stack only if its header agrees with cls, so
+// a caller that passes the wrong class gets mm_free's routing instead of
+// a block of the wrong size on the stack.
+//
+void mm_free_class(void *ptr, int cls)
+{
+  uint32_t hdr;
+
+  // The same test as small_cache, with the header checked against cls
+  if (!IS_GUARDED(ptr) && !IS_SEALED(ptr) &&
+      ((hdr = GET(HDRP(ptr))) & ROUTE) == SMALL && hdr / DSIZE == (uint32_t)cls &&
+      GET_ALLOC((char *)ptr - DSIZE) && GET_ALLOC(HDRP(NEXT_BLKP(ptr))) &&
+      small_push(cls, ptr)){
+    return;
+  }
+  mm_free(ptr);
 }
 
 // 
 // mm_free - Free a block 
 //
+// Guarded blocks are told apart by address and the rest by the route
+// bits in their header: run blocks go back to their run (free_special),
+// SMALL blocks are cached (small_cache) and everything else is returned
+// to the heap.
+//
+void mm_free(void *bp)
+{
+  if (free_special(bp)){
+    return;
+  }
+  if (small_cache(bp)){
+    return;
+  }
+
+  // Leave the coalescing to the maintenance thread if it is running
+  if (atomic_load_explicit(&maint_running, memory_order_relaxed)){
+    stack_push(&deferred, bp);
+    if (atomic_load_explicit(&deferred.count, memory_order_relaxed) == DEFER_KICK){
+      mm_maint_kick();
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  heap_free(bp);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// free_special - Free bp if it is a run, guarded or sealed block, none
+//                of which ever goes back to the heap. Returns 1 if it was
+//
+static int free_special(void *bp)
+{
+  if (IS_GUARDED(bp)){
+    guard_free(bp);
+    return 1;
+  }
+  if (IS_SEALED(bp)){
+    seal_free(bp);
+    return 1;
+  }
+  if ((GET(HDRP(bp)) & ROUTE) == RUN){
+    run_free(bp);
+    return 1;
+  }
+  return 0;
+}
+
+//
+// small_cache - Push bp on its class stack if its header routes it
+//               there, the stack has room and neither neighbour is free
+//               (coalescing would give back a larger block). Returns 1
+//               if bp was cached
+//
+static int small_cache(void *bp)
+{
+  uint32_t hdr = GET(HDRP(bp));
+
+  // SMALL is only set on blocks of at most SMALL_MAX bytes, so the
+  // header in doublewords is the class (the tag bits fall away). The
+  // neighbour tags are read without heap_lock; a stale answer only
+  // decides where the block goes, not whether the heap stays consistent
+  return (hdr & SMALL) &&
+         GET_ALLOC((char *)bp - DSIZE) && GET_ALLOC(HDRP(NEXT_BLKP(bp))) &&
+         small_push(hdr / DSIZE, bp);
+}
+
+//
+// heap_free - Return a block to the boundary-tag heap. Caller holds heap_lock
+//
 // Implicit Free list code from Computer Systems: A Programmer's Perspective,
 // page 860.
-void mm_free(void *bp)
+static void heap_free(void *bp)
 {
   // Get the block size
   size_t size = GET_SIZE((HDRP(bp)));
 
+  // The whole payload is dead, so pages moved into it can be replaced
+  if (remap_nsplits != 0 && size >= REMAP_MIN){
+    remap_reclaim(bp, FTRP(bp));
+  }
+
   // Deallocate header and footer
   PUT(HDRP(bp), PACK(size, 0));
   PUT(FTRP(bp), PACK(size, 0));
@@ -256,17 +985,22 @@ void mm_free(void *bp)
 static void *coalesce(void *bp) 
 {
   // Find footers and headers of previous and next blocks respectively
-  size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+  size_t prev_alloc = IS_SEALED(PREV_BLKP(bp)) || GET_ALLOC(FTRP(PREV_BLKP(bp)));
   size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
   size_t size = GET_SIZE(HDRP(bp));
 
   // Case 1 - If both the previous and next blocks are allocated
   if (prev_alloc && next_alloc){
-  	// Return bp - can't extend block size
+  	// Return bp - can't extend block size, only list it
+    free_insert(bp);
+    SIDE_NOTE(bp);
     return bp;
   }
   // Case 2 - If the next block is free
   else if (prev_alloc && !next_alloc){
+    // Take the next block's place on the free list
+    free_link(bp, FREE_PRED(NEXT_BLKP(bp)));
+    free_unlink(NEXT_BLKP(bp));
   	// Increase the size of the block to fit the next block
     size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
     // Place header and footer on the new concatenated block
@@ -285,6 +1019,8 @@ static void *coalesce(void *bp)
   }
   // Case 4 - If both blocks are free
   else{
+    // The previous block stays listed; the next one goes away
+    free_unlink(NEXT_BLKP(bp));
   	// Increase the size of the block to fit both the previous and next blocks
     size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
     // Place headers and footers at new concatenated blocks
@@ -299,110 +1035,2319 @@ static void *coalesce(void *bp)
   	// If it is, just set it to the beginning of the coalesced block
     next_fit = bp;
   }
+  SIDE_NOTE(bp);
 
   // return new block
   return bp;
 }
 
 //
-// mm_malloc - Allocate a block with at least size bytes of payload 
+// free_link - Put free block bp on free_list right after pred (NULL =
+//             at the head). Caller holds heap_lock
 //
-// Implicit Free list code from Computer Systems: A Programmer's Perspective,
-// page 860.
-void *mm_malloc(uint32_t size) 
+static void free_link(void *bp, void *pred)
 {
-  size_t asize;
-  size_t extendsize;
-  char *bp;
+  char *succ = pred ? FREE_SUCC(pred) : free_list;
 
-  // Ignore spurious requests
-  if (size == 0){
-    return NULL;
+  SET_PRED(bp, pred);
+  SET_SUCC(bp, succ);
+  if (side[CHUNK(bp)].first == 0 || OFFSET(bp) < side[CHUNK(bp)].first){
+    side[CHUNK(bp)].first = OFFSET(bp);
   }
-
-  // Extend size to fit header and footer & satisfy double word alignment
-  if (size <= DSIZE){
-    asize = 2*DSIZE;
+  if (CHUNK(bp) >= side_top){
+    side_top = CHUNK(bp) + 1;
   }
-  else {
-    asize = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+  if (pred){
+    SET_SUCC(pred, bp);
   }
-
-  // Search for a block that fits this request - Next Fit
-  if ((bp = find_fit(asize)) != NULL){
-    place(bp, asize);
-    return bp;
+  else {
+    free_list = bp;
   }
-
-  // If there is no fit, it extends the heap with a new free block
-  extendsize = MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize/WSIZE)) == NULL){
-  	// If we can't extend the heap any further, return NULL
-    return NULL;
+  if (succ){
+    SET_PRED(succ, bp);
   }
-  // Places the block in the new set of free blocks
-  place(bp, asize);
-  return bp;
-} 
+}
 
 //
+// free_unlink - Take free block bp off free_list. Caller holds heap_lock
 //
-// Practice problem 9.9
-//
-// place - Place block of asize bytes at start of free block bp 
-//         and split if remainder would be at least minimum block size
-//
-// Implicit Free list code from Computer Systems: A Programmer's Perspective,
-// page 884.
-static void place(void *bp, uint32_t asize)
+static void free_unlink(void *bp)
 {
-  size_t csize = GET_SIZE(HDRP(bp));
-
+  char *pred = FREE_PRED(bp);
+  char *succ = FREE_SUCC(bp);
 
-  // If the remainder of the block is greater than or equal to 2 words
-  if((csize - asize) >= (2*DSIZE)){
-  	// Allocate needed block size
-    PUT(HDRP(bp), PACK(asize, 1));
-    PUT(FTRP(bp), PACK(asize, 1));
-    // Split the block and deallocate the remainder
-    bp = NEXT_BLKP(bp);
-    PUT(HDRP(bp), PACK(csize - asize, 0));
-    PUT(FTRP(bp), PACK(csize - asize, 0));
+  if (side[CHUNK(bp)].first == OFFSET(bp)){
+    side[CHUNK(bp)].first = succ && CHUNK(succ) == CHUNK(bp) ? OFFSET(succ) : 0;
   }
-  // If the remainder of the block is less than two words
-  else{
-  	// Allocate the entire block
-    PUT(HDRP(bp), PACK(csize, 1));
-    PUT(FTRP(bp), PACK(csize, 1));
+  if (pred){
+    SET_SUCC(pred, succ);
   }
-
-  // If next_fit is pointed at the new allocated block, move it to the next block
-  if (next_fit == (char *)bp){
-  	next_fit = NEXT_BLKP(bp);
+  else {
+    free_list = succ;
+  }
+  if (succ){
+    SET_PRED(succ, pred);
   }
 }
 
-
+//
+// free_insert - Put free block bp on free_list in address order.
+//               Caller holds heap_lock
+//
+// Neither neighbour is free (coalesce saw to that), so the boundary
+// tags are stepped outward both ways, and the first free block found
+// is bp's predecessor or successor on the list. Where free blocks are
+// too sparse for that, the side table is scanned down for the nearest
+// chunk holding a lower free block.
+//
+static void free_insert(void *bp)
+{
+  char *back = bp, *fwd = NEXT_BLKP(bp), *pred, *succ;
+  uint32_t c;
+  int i;
+
+  for (i = 0; i < INSERT_WALK; i++){
+    if (back != heap_floor && !GET_ALLOC(HDRP(back = PREV_BLKP(back)))){
+      free_link(bp, back);
+      return;
+    }
+    if (GET_SIZE(HDRP(fwd)) > 0){
+      if (!GET_ALLOC(HDRP(fwd))){
+        free_link(bp, FREE_PRED(fwd));
+        return;
+      }
+      fwd = NEXT_BLKP(fwd);
+    }
+  }
+
+  pred = NULL;
+  for (c = CHUNK(bp) + 1; c-- > 0; ){
+    if (side[c].first != 0 && (char *)OFFSET_PTR(side[c].first) < (char *)bp){
+      pred = OFFSET_PTR(side[c].first);
+      break;
+    }
+  }
+  while (pred != NULL && (succ = FREE_SUCC(pred)) != NULL && succ < (char *)bp){
+    pred = succ;
+  }
+  free_link(bp, pred);
+}
+
+//
+// side_next - Lowest free block in the first chunk from c on whose size
+//             bound admits asize, or NULL. Caller holds heap_lock
+//
+static void *side_next(uint32_t c, uint32_t asize)
+{
+  uint32_t n = NCHUNKS();
+
+  for (; c < n; c++){
+    if (side[c].max >= asize){
+      if (side[c].first != 0){
+        return OFFSET_PTR(side[c].first);
+      }
+      side[c].max = 0;
+    }
+  }
+  return NULL;
+}
+
+//
+// mm_malloc - Allocate a block with at least size bytes of payload 
+//
+// Small requests are served from their class stack; on a miss the
+// stack is refilled from the heap.
+//
+void *mm_malloc(uint32_t size) 
+{
+  uint32_t asize;
+  char *bp;
+  int i;
+
+  // Ignore spurious requests
+  if (size == 0){
+    return NULL;
+  }
+
+  // Extend size to fit header and footer & satisfy double word alignment
+  asize = ASIZE(size);
+
+  // Finish this thread's pending mm_free_async calls first
+  if (thread_state.nasync > 0){
+    async_flush(&thread_state);
+  }
+
+  // Every guard_rate-th request goes to the guarded pool if it can
+  if (guard_rate && guard_sample()){
+    if ((bp = guard_malloc(size)) != NULL){
+      return bp;
+    }
+  }
+
+  if (asize <= SMALL_MAX && small_mode == MM_SMALL_RUNS){
+    return run_malloc(asize);
+  }
+  if (asize <= SMALL_MAX && small_mode != MM_SMALL_OFF){
+    if ((bp = small_pop(asize/DSIZE)) != NULL){
+      return bp;
+    }
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  if ((bp = heap_malloc(asize)) == NULL){
+    bp = heap_reclaim(asize);
+  }
+  // Tag the block for the stack, and carve extra blocks for it while
+  // we hold the lock anyway
+  if (bp != NULL && asize <= SMALL_MAX && small_mode != MM_SMALL_OFF){
+    if (GET_SIZE(HDRP(bp)) <= SMALL_MAX){
+      SET_SMALL(bp);
+    }
+    for (i = 1; i < small_refill; i++){
+      char *extra = heap_malloc(asize);
+      if (extra == NULL){
+        break;
+      }
+      if (GET_SIZE(HDRP(extra)) > SMALL_MAX){
+        heap_free(extra);
+        break;
+      }
+      SET_SMALL(extra);
+      if (!small_push(GET_SIZE(HDRP(extra))/DSIZE, extra)){
+        heap_free(extra);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&heap_lock);
+  return bp;
+}
+
+//
+// heap_malloc - Allocate asize bytes from the boundary-tag heap.
+//               Caller holds heap_lock
+//
+// Implicit Free list code from Computer Systems: A Programmer's Perspective,
+// page 860.
+static void *heap_malloc(uint32_t asize)
+{
+  size_t extendsize;
+  char *bp;
+
+  split_note(asize);
+
+  // Search for a block that fits this request - Next Fit. Coalesce
+  // any deferred frees and look again before growing the heap
+  if ((bp = find_fit(asize)) != NULL ||
+      (drain_deferred() && (bp = find_fit(asize)) != NULL)){
+    place(bp, asize);
+    return bp;
+  }
+
+  // If there is no fit, it extends the heap with a new free block,
+  // only as far as needed when a full chunk would break the budget
+  extendsize = MAX(asize, CHUNKSIZE);
+  if (heap_limit && mem_heapsize() + extendsize > heap_limit){
+    if (mem_heapsize() + asize > heap_limit){
+      return NULL;
+    }
+    extendsize = asize;
+  }
+  // A full chunk may not fit under the memory system's limit when the
+  // request alone still does
+  if ((bp = extend_heap(extendsize/WSIZE)) == NULL &&
+      (extendsize == asize || (bp = extend_heap(asize/WSIZE)) == NULL)){
+  	// If we can't extend the heap any further, return NULL
+    return NULL;
+  }
+  // Places the block in the new set of free blocks
+  place(bp, asize);
+  return bp;
+} 
+
+//
+// stack_pop - Lock-free pop from a tagged block stack, or NULL if empty
+//
+static void *stack_pop(block_stack_t *st)
+{
+  uint64_t head, next;
+  char *bp;
+
+  head = atomic_load_explicit(&st->head, memory_order_acquire);
+  do {
+    if ((bp = OFFSET_PTR((uint32_t)head)) == NULL){
+      return NULL;
+    }
+    // bp may be popped and reused under us; the read is still inside
+    // the heap and the tag makes the CAS below fail in that case
+    next = STACK_HEAD(*(volatile uint32_t *)bp, (uint32_t)(head >> 32) + 1);
+  } while (!atomic_compare_exchange_weak_explicit(&st->head, &head, next,
+                                                  memory_order_acquire,
+                                                  memory_order_acquire));
+  atomic_fetch_sub_explicit(&st->count, 1, memory_order_relaxed);
+  return bp;
+}
+
+//
+// stack_push - Lock-free push of block bp on a tagged block stack
+//
+static void stack_push(block_stack_t *st, void *bp)
+{
+  uint64_t head, top;
+
+  atomic_fetch_add_explicit(&st->count, 1, memory_order_relaxed);
+  head = atomic_load_explicit(&st->head, memory_order_relaxed);
+  do {
+    *(uint32_t *)bp = (uint32_t)head;
+    top = STACK_HEAD(OFFSET(bp), (uint32_t)(head >> 32) + 1);
+  } while (!atomic_compare_exchange_weak_explicit(&st->head, &head, top,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+//
+// stack_take - Detach every block on a stack at once and return the top
+//              one; the rest follow through STACK_NEXT
+//
+static void *stack_take(block_stack_t *st)
+{
+  uint64_t head = atomic_exchange_explicit(&st->head, 0, memory_order_acquire);
+
+  atomic_store_explicit(&st->count, 0, memory_order_relaxed);
+  return OFFSET_PTR((uint32_t)head);
+}
+
+//
+// small_pop - Take a cached block of class cls, or NULL if there is none
+//
+static void *small_pop(int cls)
+{
+  block_stack_t *st = &small_stacks[cls];
+  uint64_t head;
+  char *bp;
+
+  if (small_mode != MM_SMALL_LOCKED){
+    return stack_pop(st);
+  }
+
+  pthread_mutex_lock(&small_locks[cls]);
+  head = atomic_load_explicit(&st->head, memory_order_relaxed);
+  if ((bp = OFFSET_PTR((uint32_t)head)) != NULL){
+    atomic_store_explicit(&st->head, STACK_HEAD(*(uint32_t *)bp, 0),
+                          memory_order_relaxed);
+    atomic_fetch_sub_explicit(&st->count, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&small_locks[cls]);
+  return bp;
+}
+
+//
+// small_push - Cache block bp on the stack for class cls. Returns 0
+//              without caching it if the stack is full or disabled
+//
+static int small_push(int cls, void *bp)
+{
+  block_stack_t *st = &small_stacks[cls];
+  uint64_t head;
+
+  if ((small_mode != MM_SMALL_LOCKED && small_mode != MM_SMALL_LOCKFREE) ||
+      atomic_load_explicit(&st->count, memory_order_relaxed) >= SMALL_CAP){
+    return 0;
+  }
+  if (small_mode == MM_SMALL_LOCKFREE){
+    stack_push(st, bp);
+    return 1;
+  }
+
+  pthread_mutex_lock(&small_locks[cls]);
+  atomic_fetch_add_explicit(&st->count, 1, memory_order_relaxed);
+  head = atomic_load_explicit(&st->head, memory_order_relaxed);
+  *(uint32_t *)bp = (uint32_t)head;
+  atomic_store_explicit(&st->head, STACK_HEAD(OFFSET(bp), 0),
+                        memory_order_relaxed);
+  pthread_mutex_unlock(&small_locks[cls]);
+  return 1;
+}
+
+//
+// mm_set_small_mode - Select how small blocks are cached (MM_SMALL_OFF,
+//                     MM_SMALL_LOCKED, MM_SMALL_LOCKFREE or MM_SMALL_RUNS)
+//                     and how many are carved from the heap on a stack
+//                     miss. Call it before mm_init; switching modes with
+//                     blocks cached is unsafe.
+//
+void mm_set_small_mode(int mode, int refill)
+{
+  small_mode = mode;
+  small_refill = refill < 1 ? 1 : refill;
+}
+
+//
+//
+// Practice problem 9.9
+//
+// place - Place block of asize bytes at start of free block bp 
+//         and split if remainder would be at least minimum block size
+//
+// Implicit Free list code from Computer Systems: A Programmer's Perspective,
+// page 884.
+static void place(void *bp, uint32_t asize)
+{
+  size_t csize = GET_SIZE(HDRP(bp));
+
+
+  // If the remainder of the block is big enough for a request in demand
+  if((csize - asize) >= split_min){
+    // The remainder takes the block's place on the free list
+    void *pred = FREE_PRED(bp);
+    free_unlink(bp);
+    free_link((char *)bp + asize, pred);
+  	// Allocate needed block size
+    PUT(HDRP(bp), PACK(asize, 1));
+    PUT(FTRP(bp), PACK(asize, 1));
+    // Split the block and deallocate the remainder
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(csize - asize, 0));
+    PUT(FTRP(bp), PACK(csize - asize, 0));
+    SIDE_NOTE(bp);
+  }
+  // If the remainder of the block is only a splinter
+  else{
+    free_unlink(bp);
+  	// Allocate the entire block
+    PUT(HDRP(bp), PACK(csize, 1));
+    PUT(FTRP(bp), PACK(csize, 1));
+  }
+
+  // If next_fit is pointed at the new allocated block, move it to the next block
+  if (next_fit == (char *)bp){
+  	next_fit = NEXT_BLKP(bp);
+  }
+}
+
+
+//
+// split_note - Count a heap request of asize bytes toward the demand
+//              that sets split_min. Caller holds heap_lock
+//
+// Every SPLIT_WINDOW requests, split_min becomes the smallest class
+// that made up at least 1/SPLIT_SHARE of them, or just past SMALL_MAX
+// if no small class did.
+//
+static void split_note(uint32_t asize)
+{
+  int c;
+
+  split_demand[asize <= SMALL_MAX ? asize/DSIZE : NSMALL]++;
+  if (++split_count < SPLIT_WINDOW){
+    return;
+  }
+
+  split_min = SMALL_MAX + DSIZE;
+  for (c = 2; c < NSMALL; c++){
+    if (split_demand[c] * SPLIT_SHARE >= SPLIT_WINDOW){
+      split_min = c * DSIZE;
+      break;
+    }
+  }
+  memset(split_demand, 0, sizeof(split_demand));
+  split_count = 0;
+}
+
 //
 // mm_realloc -- implemented for you
 //
-void *mm_realloc(void *ptr, uint32_t size)
+// Returns NULL and leaves ptr untouched if the new block cannot be had.
+// A heap block is first resized where it is (see heap_resize); only if
+// that fails is the payload moved to a new block. A large payload is
+// moved with move_payload, which remaps whole pages instead of copying
+// them when the new block is placed at the same offset within a page as
+// the old one.
+//
+void *mm_realloc(void *ptr, uint32_t size)
+{
+  void *newp = NULL;
+  uint32_t copySize;
+
+  copySize = GET_SIZE(HDRP(ptr)) - OVERHEAD;
+  if (size < copySize) {
+    copySize = size;
+  }
+
+  // Run, guarded and sealed blocks never change size
+  if (!IS_GUARDED(ptr) && !IS_SEALED(ptr) && !(GET(HDRP(ptr)) & RUN)) {
+    pthread_mutex_lock(&heap_lock);
+    newp = heap_resize(ptr, ASIZE(size), 1);
+    if (newp == NULL && copySize >= REMAP_MIN) {
+      newp = heap_malloc_congruent(ASIZE(size), ptr);
+    }
+    else if (newp != NULL) {
+      pthread_mutex_unlock(&heap_lock);
+      return newp;
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+  else if (copySize >= REMAP_MIN) {
+    pthread_mutex_lock(&heap_lock);
+    newp = heap_malloc_congruent(ASIZE(size), ptr);
+    pthread_mutex_unlock(&heap_lock);
+  }
+  if (newp == NULL && (newp = mm_malloc(size)) == NULL) {
+    return NULL;
+  }
+  move_payload(newp, ptr, copySize);
+  mm_free(ptr);
+  return newp;
+}
+
+//
+// heap_resize - Resize the allocated block bp to asize without moving it
+//               elsewhere, or return NULL. Caller holds heap_lock
+//
+// The block grows into a free successor first, and at the end of the
+// heap the heap grows by just the shortfall. If that is not enough but
+// a free predecessor makes up the rest, and move is set, the payload is
+// moved down into it. Whatever is left past asize is split off as a
+// free block.
+//
+static void *heap_resize(void *bp, uint32_t asize, int move)
+{
+  uint32_t size = GET_SIZE(HDRP(bp));
+  uint32_t prev = 0, next = 0, need;
+  char *newbp = bp, *pred;
+  char *succ = NEXT_BLKP(bp);
+
+  if (!GET_ALLOC(HDRP(succ))){
+    next = GET_SIZE(HDRP(succ));
+    succ = NEXT_BLKP(succ);
+  }
+  if (size + next < asize && GET_SIZE(HDRP(succ)) == 0){
+    need = MAX(asize - size - next, 2*DSIZE);
+    if ((!heap_limit || mem_heapsize() + need <= heap_limit) &&
+        extend_heap(need/WSIZE) != NULL){
+      next += need;
+    }
+  }
+  if (size + next < asize){
+    if (!move || GET_ALLOC((char *)bp - DSIZE) || IS_SEALED(PREV_BLKP(bp)) ||
+        (prev = GET_SIZE((char *)bp - DSIZE)) + size + next < asize){
+      return NULL;
+    }
+    newbp = PREV_BLKP(bp);
+  }
+
+  // The merged free blocks leave the list, and a remainder goes back
+  // where they were. This is done before the payload moves over the
+  // predecessor's links
+  pred = prev ? FREE_PRED(newbp) : next ? FREE_PRED(NEXT_BLKP(bp)) : NULL;
+  if (prev){
+    free_unlink(newbp);
+  }
+  if (next){
+    free_unlink(NEXT_BLKP(bp));
+  }
+
+  // The payload moves before any tag is written, since the new
+  // footer may land inside the old payload
+  if (newbp != bp){
+    memmove(newbp, bp, size - OVERHEAD);
+    atomic_fetch_add(&realloc_copied, size - OVERHEAD);
+  }
+
+  size += prev + next;
+  if (size - asize >= 2*DSIZE){
+    PUT(HDRP(newbp), PACK(asize, 1));
+    PUT(FTRP(newbp), PACK(asize, 1));
+    PUT(HDRP(NEXT_BLKP(newbp)), PACK(size - asize, 0));
+    PUT(FTRP(NEXT_BLKP(newbp)), PACK(size - asize, 0));
+    if (prev || next){
+      free_link(NEXT_BLKP(newbp), pred);
+    }
+    else {
+      free_insert(NEXT_BLKP(newbp));
+    }
+    SIDE_NOTE(NEXT_BLKP(newbp));
+  }
+  else {
+    PUT(HDRP(newbp), PACK(size, 1));
+    PUT(FTRP(newbp), PACK(size, 1));
+  }
+
+  // Keep next_fit off the inside of the blocks that were merged
+  if (next_fit >= newbp && next_fit < newbp + size){
+    next_fit = NEXT_BLKP(newbp);
+  }
+  return newbp;
+}
+
+//
+// mm_expand - Grow the block at ptr where it is to hold as close to
+//             max_size bytes as it can, and at least min_size. Returns
+//             the new usable size, or 0 if the block cannot hold
+//             min_size without moving; the block is then unchanged
+//
+// Unlike mm_realloc this never moves the block and never shrinks it,
+// so pointers into the payload stay valid either way. It tries max_size
+// first, then as much as the free successor gives without growing the
+// heap, then min_size.
+//
+uint32_t mm_expand(void *ptr, uint32_t min_size, uint32_t max_size)
+{
+  uint32_t size, avail;
+  char *next;
+
+  if (ptr == NULL || min_size == 0){
+    return 0;
+  }
+  // ASIZE wraps past MAX_REQUEST, so "as far as it goes" is clamped
+  if (min_size > MAX_REQUEST){
+    return 0;
+  }
+  if (max_size > MAX_REQUEST){
+    max_size = MAX_REQUEST;
+  }
+  size = GET_SIZE(HDRP(ptr));
+  if (max_size < min_size){
+    max_size = min_size;
+  }
+  if (ASIZE(max_size) <= size && size - OVERHEAD >= min_size){
+    return size - OVERHEAD;
+  }
+
+  // Run, guarded and sealed blocks never change size
+  if (IS_GUARDED(ptr) || IS_SEALED(ptr) || (GET(HDRP(ptr)) & RUN)){
+    return size - OVERHEAD >= min_size ? size - OVERHEAD : 0;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  if (heap_resize(ptr, ASIZE(max_size), 0) == NULL){
+    next = NEXT_BLKP(ptr);
+    avail = size + (GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)));
+    if (avail > size && avail >= ASIZE(min_size)){
+      heap_resize(ptr, avail, 0);
+    }
+    else if (size - OVERHEAD < min_size &&
+             heap_resize(ptr, ASIZE(min_size), 0) == NULL){
+      pthread_mutex_unlock(&heap_lock);
+      return 0;
+    }
+  }
+  size = GET_SIZE(HDRP(ptr));
+  pthread_mutex_unlock(&heap_lock);
+  return size - OVERHEAD;
+}
+
+//
+// heap_malloc_congruent - Allocate asize bytes at the same offset within
+//                         a page as ptr, or NULL. Caller holds heap_lock
+//
+// A page more than needed is allocated; the lead up to the right offset
+// and whatever is left past asize go straight back to the heap.
+//
+static void *heap_malloc_congruent(uint32_t asize, void *ptr)
+{
+  size_t pagesize = mem_pagesize();
+  uint32_t total, lead, rest;
+  char *bp, *newbp;
+
+  if ((bp = heap_malloc(asize + pagesize + 2*DSIZE)) == NULL){
+    return NULL;
+  }
+  total = GET_SIZE(HDRP(bp));
+
+  // The lead must be empty or big enough to be a block of its own
+  lead = ((uintptr_t)ptr - (uintptr_t)bp) & (pagesize - 1);
+  if (lead != 0 && lead < 2*DSIZE){
+    lead += pagesize;
+  }
+  newbp = bp + lead;
+  rest = total - lead - asize;
+
+  // The lead stays allocated until the tail is back on the free list,
+  // so neither is found unlisted by the other's insertion
+  if (lead != 0){
+    PUT(HDRP(bp), PACK(lead, 1));
+    PUT(FTRP(bp), PACK(lead, 1));
+  }
+  if (rest >= 2*DSIZE){
+    PUT(HDRP(newbp), PACK(asize, 1));
+    PUT(FTRP(newbp), PACK(asize, 1));
+    PUT(HDRP(NEXT_BLKP(newbp)), PACK(rest, 0));
+    PUT(FTRP(NEXT_BLKP(newbp)), PACK(rest, 0));
+    coalesce(NEXT_BLKP(newbp));
+  }
+  else {
+    PUT(HDRP(newbp), PACK(asize + rest, 1));
+    PUT(FTRP(newbp), PACK(asize + rest, 1));
+  }
+  if (lead != 0){
+    heap_free(bp);
+  }
+  return newbp;
+}
+
+//
+// move_payload - Copy n bytes from src to dst, the whole pages in the
+//                middle by mremap if src and dst share a page offset.
+//                The pages left behind at src are replaced by zero pages
+//
+// The zero pages are mapped before anything moves, so running out of
+// mappings just means a plain copy. Once the payload pages have moved
+// there is no going back, and failing to put the zero pages in their
+// place would leave a hole in the heap, so that aborts. The zero pages
+// are then mapped afresh to join the heap's mapping again; the pages
+// moved to dst split it until remap_reclaim, so each move first claims
+// a place out of REMAP_SPLITS.
+//
+static void move_payload(void *dst, void *src, uint32_t n)
+{
+  size_t pagesize = mem_pagesize();
+  uintptr_t lo = ((uintptr_t)src + pagesize - 1) & ~(pagesize - 1);
+  uintptr_t hi = ((uintptr_t)src + n) & ~(pagesize - 1);
+  char *to = (char *)dst + (lo - (uintptr_t)src);
+  void *zero = MAP_FAILED;
+
+  if (n >= REMAP_MIN && hi > lo &&
+      (((uintptr_t)dst ^ (uintptr_t)src) & (pagesize - 1)) == 0 &&
+      remap_claim()){
+    zero = mmap(NULL, hi - lo, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (zero == MAP_FAILED){
+      remap_record(0, 0);
+    }
+  }
+  if (zero != MAP_FAILED &&
+      mremap((void *)lo, hi - lo, hi - lo, MREMAP_MAYMOVE | MREMAP_FIXED,
+             to) == MAP_FAILED){
+    munmap(zero, hi - lo);
+    zero = MAP_FAILED;
+    remap_record(0, 0);
+  }
+  if (zero != MAP_FAILED){
+    remap_record((uintptr_t)to, (uintptr_t)to + (hi - lo));
+    if (mremap(zero, hi - lo, hi - lo, MREMAP_MAYMOVE | MREMAP_FIXED,
+               (void *)lo) == MAP_FAILED){
+      fprintf(stderr, "mm: cannot refill %p..%p after moving its pages\n",
+              (void *)lo, (void *)hi);
+      abort();
+    }
+    remap_fresh(lo, hi);
+    memcpy(dst, src, lo - (uintptr_t)src);
+    memcpy(to + (hi - lo), (void *)hi, (uintptr_t)src + n - hi);
+    atomic_fetch_add(&realloc_remapped, hi - lo);
+    atomic_fetch_add(&realloc_copied, n - (hi - lo));
+    return;
+  }
+  memcpy(dst, src, n);
+  atomic_fetch_add(&realloc_copied, n);
+}
+
+//
+// remap_claim - Take a place for a range move_payload is about to move
+//               into the heap, or return 0 if all REMAP_SPLITS are taken
+//
+static int remap_claim(void)
+{
+  int ok;
+
+  pthread_mutex_lock(&heap_lock);
+  ok = remap_nsplits < REMAP_SPLITS;
+  remap_nsplits += ok;
+  pthread_mutex_unlock(&heap_lock);
+  return ok;
+}
+
+//
+// remap_record - Note that a claimed place went to the pages lo..hi, or
+//                give it back if lo == hi because nothing moved
+//
+static void remap_record(uintptr_t lo, uintptr_t hi)
+{
+  int i;
+
+  pthread_mutex_lock(&heap_lock);
+  if (lo == hi){
+    remap_nsplits--;
+  }
+  else {
+    for (i = 0; remap_splits[i].hi != 0; i++)
+      ;
+    remap_splits[i].lo = lo;
+    remap_splits[i].hi = hi;
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// remap_reclaim - Map every moved-in range that lies wholly within the
+//                 dead bytes lo..hi afresh, and give back its place.
+//                 Caller holds heap_lock
+//
+static void remap_reclaim(char *lo, char *hi)
+{
+  int i;
+
+  for (i = 0; i < REMAP_SPLITS; i++){
+    if (remap_splits[i].hi == 0 || remap_splits[i].lo < (uintptr_t)lo ||
+        remap_splits[i].hi > (uintptr_t)hi){
+      continue;
+    }
+    remap_fresh(remap_splits[i].lo, remap_splits[i].hi);
+    remap_splits[i].lo = remap_splits[i].hi = 0;
+    remap_nsplits--;
+  }
+}
+
+//
+// remap_fresh - Replace the dead pages lo..hi with new zero pages
+//
+// MAP_FIXED drops the old pages, and the new ones line up with the heap's
+// mapping and have its flags, so the kernel merges them into it. Should
+// the mmap fail the range may already be gone, which would leave a hole
+// in the heap, so that aborts.
+//
+static void remap_fresh(uintptr_t lo, uintptr_t hi)
+{
+  if (mmap((void *)lo, hi - lo, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+           -1, 0) == MAP_FAILED){
+    fprintf(stderr, "mm: cannot map %p..%p afresh\n", (void *)lo, (void *)hi);
+    abort();
+  }
+}
+
+//
+// mm_realloc_stats - Bytes mm_realloc has copied and remapped since
+//                    mm_init
+//
+void mm_realloc_stats(mm_realloc_stats_t *stats)
+{
+  stats->bytes_copied = atomic_load(&realloc_copied);
+  stats->bytes_remapped = atomic_load(&realloc_remapped);
+}
+
+//
+// mm_malloc_usable_size - Payload bytes of the allocated block ptr. This
+//                         is at least what was asked for, plus the
+//                         rounding and any remainder too small to split
+//
+// Heap, run and guarded blocks all have a header whose size covers the
+// payload and OVERHEAD, so one formula serves every route.
+//
+uint32_t mm_malloc_usable_size(void *ptr)
+{
+  if (ptr == NULL){
+    return 0;
+  }
+  return GET_SIZE(HDRP(ptr)) - OVERHEAD;
+}
+
+//
+// mm_good_size - Payload bytes mm_malloc(size) is sure to return, so a
+//                caller can round its capacity up to it for free
+//
+uint32_t mm_good_size(uint32_t size)
+{
+  if (size == 0){
+    return 0;
+  }
+  return ASIZE(size) - OVERHEAD;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Background maintenance
+//
+// mm_maint_start runs a thread that takes housekeeping off the
+// mm_malloc/mm_free path. While it runs, mm_free pushes heap-bound
+// blocks on the deferred stack instead of taking heap_lock, and every
+// pass of the thread
+//   - returns the deferred blocks to the heap and coalesces them,
+//   - flushes half of every small-class stack back to the heap,
+//   - trims a large free block at the end of the heap with mem_sbrk, and
+//   - madvises away the interior pages of large free blocks.
+// A pass runs every period_ms, or as soon as mm_maint_kick is called
+// (mm_free calls it when DEFER_KICK frees are waiting).
+//
+
+//
+// drain_deferred - Return every deferred block to the heap and give the
+//                  number returned. Caller holds heap_lock
+//
+static int drain_deferred(void)
+{
+  char *bp, *next;
+  int n = 0;
+
+  // Free in address order so neighbours coalesce one after another
+  for (bp = sort_chain(stack_take(&deferred)); bp != NULL; bp = next){
+    next = STACK_NEXT(bp);
+    heap_free(bp);
+    n++;
+  }
+  maint_stats.deferred_frees += n;
+  return n;
+}
+
+//
+// trim_heap - Shrink the heap if it ends in a free block of at least
+//             TRIM_MIN bytes, keeping CHUNKSIZE of it. Caller holds heap_lock
+//
+static void trim_heap(void)
+{
+  char *epilogue = (char *)mem_heap_hi() + 1;   // bp of the epilogue
+  char *bp;
+  uint32_t size, cut;
+  size_t pagesize = mem_pagesize();
+  uintptr_t lo, hi;
+
+  if (GET_ALLOC((char *)epilogue - DSIZE)){
+    return;
+  }
+  bp = PREV_BLKP(epilogue);
+  size = GET_SIZE(HDRP(bp));
+  if (size < TRIM_MIN || IS_SEALED(bp)){
+    return;
+  }
+
+  cut = size - CHUNKSIZE;
+  PUT(HDRP(bp), PACK(CHUNKSIZE, 0));
+  PUT(FTRP(bp), PACK(CHUNKSIZE, 0));
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+  if (next_fit > (char *)bp){
+    next_fit = bp;
+  }
+  mem_sbrk(-(int)cut);
+
+  // Give the pages past the new break back, as a real sbrk would
+  lo = ((uintptr_t)epilogue - cut + pagesize - 1) & ~(pagesize - 1);
+  hi = (uintptr_t)epilogue & ~(pagesize - 1);
+  if (hi > lo){
+    madvise((void *)lo, hi - lo, MADV_DONTNEED);
+  }
+  maint_stats.bytes_trimmed += cut;
+}
+
+//
+// purge_heap - madvise away the page-aligned interior of every free
+//              block of at least PURGE_MIN bytes not already purged.
+//              The first payload doubleword and the footer stay resident.
+//              Caller holds heap_lock
+//
+static void purge_heap(void)
+{
+  char *bp;
+  uint32_t size;
+  size_t pagesize = mem_pagesize();
+  uintptr_t lo, hi;
+
+  for (bp = free_list; bp != NULL; bp = FREE_SUCC(bp)){
+    size = GET_SIZE(HDRP(bp));
+    if (size < PURGE_MIN || (GET(HDRP(bp)) & PURGED)){
+      continue;
+    }
+    lo = ((uintptr_t)bp + DSIZE + pagesize - 1) & ~(pagesize - 1);
+    hi = (uintptr_t)FTRP(bp) & ~(pagesize - 1);
+    if (hi > lo && madvise((void *)lo, hi - lo, MADV_DONTNEED) == 0){
+      maint_stats.pages_purged += (hi - lo) / pagesize;
+    }
+    // Any later PUT of this block's tags clears the mark again
+    PUT(HDRP(bp), GET(HDRP(bp)) | PURGED);
+    PUT(FTRP(bp), GET(FTRP(bp)) | PURGED);
+  }
+}
+
+//
+// maint_pass - One round of housekeeping. heap_lock is taken per step
+//              so request threads can get in between
+//
+static void maint_pass(void)
+{
+  char *bp;
+  int i, n;
+
+  pthread_mutex_lock(&heap_lock);
+  drain_deferred();
+  pthread_mutex_unlock(&heap_lock);
+
+  for (i = 0; i < NSMALL; i++){
+    n = atomic_load_explicit(&small_stacks[i].count, memory_order_relaxed) / 2;
+    if (n == 0){
+      continue;
+    }
+    pthread_mutex_lock(&heap_lock);
+    for (; n > 0 && (bp = small_pop(i)) != NULL; n--){
+      heap_free(bp);
+      maint_stats.cache_flushed++;
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+
+  // Move the epoch along so retired blocks of exited threads get freed
+  epoch_advance();
+  epoch_reclaim(NULL);
+
+  pthread_mutex_lock(&heap_lock);
+  trim_heap();
+  pthread_mutex_unlock(&heap_lock);
+
+  pthread_mutex_lock(&heap_lock);
+  purge_heap();
+  maint_stats.passes++;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// maint_main - Body of the maintenance thread
+//
+static void *maint_main(void *arg)
+{
+  struct timespec ts;
+
+  pthread_mutex_lock(&maint_lock);
+  while (!maint_stop_req){
+    if (!maint_kicked){
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += maint_period_ms / 1000;
+      ts.tv_nsec += (maint_period_ms % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&maint_cond, &maint_lock, &ts);
+    }
+    if (maint_stop_req){
+      break;
+    }
+    maint_kicked = 0;
+    pthread_mutex_unlock(&maint_lock);
+    maint_pass();
+    pthread_mutex_lock(&maint_lock);
+  }
+  pthread_mutex_unlock(&maint_lock);
+  return NULL;
+}
+
+//
+// mm_maint_start - Start the maintenance thread with a pass every
+//                  period_ms milliseconds. Returns -1 if it is already
+//                  running or cannot be created
+//
+int mm_maint_start(unsigned int period_ms)
+{
+  if (atomic_load(&maint_running)){
+    return -1;
+  }
+  maint_period_ms = period_ms ? period_ms : 1;
+  maint_stop_req = 0;
+  maint_kicked = 0;
+  if (pthread_create(&maint_tid, NULL, maint_main, NULL) != 0){
+    return -1;
+  }
+  atomic_store(&maint_running, 1);
+  return 0;
+}
+
+//
+// mm_maint_stop - Stop the maintenance thread and return any frees it
+//                 had not got to yet. Must be called before mm_init
+//
+void mm_maint_stop(void)
+{
+  if (!atomic_load(&maint_running)){
+    return;
+  }
+  atomic_store(&maint_running, 0);
+
+  pthread_mutex_lock(&maint_lock);
+  maint_stop_req = 1;
+  pthread_cond_signal(&maint_cond);
+  pthread_mutex_unlock(&maint_lock);
+  pthread_join(maint_tid, NULL);
+
+  pthread_mutex_lock(&heap_lock);
+  drain_deferred();
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// mm_maint_kick - Ask for a maintenance pass now (e.g. on memory pressure)
+//
+void mm_maint_kick(void)
+{
+  pthread_mutex_lock(&maint_lock);
+  maint_kicked = 1;
+  pthread_cond_signal(&maint_cond);
+  pthread_mutex_unlock(&maint_lock);
+}
+
+//
+// mm_maint_stats - Copy out the counters of the work done so far
+//
+void mm_maint_stats(mm_maint_stats_t *stats)
+{
+  pthread_mutex_lock(&heap_lock);
+  *stats = maint_stats;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Sampled guarded allocations
+//
+// With mm_set_guard_rate(n), one request in n (counted per thread) of at
+// most a page is served from the guarded pool instead. The block is put
+// at the end of its slot page, right against a PROT_NONE guard page, so
+// running off its end faults at once. Freeing it makes the slot page
+// PROT_NONE as well and leaves it in quarantine while the other slots
+// are used first, so a use after free faults too. A SIGSEGV handler
+// says which guarded block a fault hit before the process dies.
+//
+
+//
+// guard_report - SIGSEGV handler: describe a fault inside the pool, then
+//                let it happen again under the previous handler. A fault
+//                outside the pool goes straight to the previous handler
+//
+// Only async-signal-safe calls are made here, so the message is built
+// on the stack with guard_puts and guard_putu and written with write(2).
+//
+static void guard_report(int sig, siginfo_t *si, void *ctx)
+{
+  char *addr = si->si_addr;
+  char msg[128], *p = msg, *end = msg + sizeof(msg);
+  size_t page;
+  int i;
+
+  if (guard_pool == NULL || addr < guard_pool ||
+      addr >= guard_pool + (2*GUARD_SLOTS + 1) * guard_page){
+    if (guard_oldsa.sa_flags & SA_SIGINFO){
+      guard_oldsa.sa_sigaction(sig, si, ctx);
+      return;
+    }
+    if (guard_oldsa.sa_handler != SIG_DFL &&
+        guard_oldsa.sa_handler != SIG_IGN){
+      guard_oldsa.sa_handler(sig);
+      return;
+    }
+    guard_unhook();
+    return;
+  }
+
+  page = (addr - guard_pool) / guard_page;
+  // An odd page is a slot, an even one the guard after slot page/2 - 1
+  i = (page % 2) ? (int)(page / 2) : (int)(page / 2) - 1;
+  if (i >= 0 && guard_slots[i].bp != NULL){
+    p = guard_puts(p, end, guard_slots[i].live ?
+                   "mm: heap-buffer-overflow at 0x" : "mm: use-after-free at 0x");
+    p = guard_putu(p, end, (uintptr_t)addr, 16);
+    p = guard_puts(p, end, " on guarded block 0x");
+    p = guard_putu(p, end, (uintptr_t)guard_slots[i].bp, 16);
+    p = guard_puts(p, end, " (");
+    p = guard_putu(p, end, guard_slots[i].size, 10);
+    p = guard_puts(p, end, " bytes)\n");
+  }
+  else {
+    p = guard_puts(p, end, "mm: wild access at 0x");
+    p = guard_putu(p, end, (uintptr_t)addr, 16);
+    p = guard_puts(p, end, " in the guarded pool\n");
+  }
+  if (write(STDERR_FILENO, msg, p - msg) < 0){
+    // Nothing to be done about a failed write here
+  }
+  guard_unhook();
+}
+
+//
+// guard_puts - Append s to the message being built at p, stopping at end
+//
+static char *guard_puts(char *p, char *end, const char *s)
+{
+  while (*s != '\0' && p < end){
+    *p++ = *s++;
+  }
+  return p;
+}
+
+//
+// guard_putu - Append v in base 10 or 16 to the message being built at p
+//
+static char *guard_putu(char *p, char *end, uintptr_t v, int base)
+{
+  char digits[3 * sizeof(v)];
+  int n = 0;
+
+  do {
+    digits[n++] = "0123456789abcdef"[v % base];
+    v /= base;
+  } while (v != 0);
+  while (n > 0 && p < end){
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+//
+// guard_unhook - Put back the SIGSEGV handler guard_init replaced, unless
+//                another has been installed over guard_report since
+//
+static void guard_unhook(void)
+{
+  struct sigaction sa;
+
+  if (sigaction(SIGSEGV, NULL, &sa) == 0 && (sa.sa_flags & SA_SIGINFO) &&
+      sa.sa_sigaction == guard_report){
+    sigaction(SIGSEGV, &guard_oldsa, NULL);
+  }
+}
+
+//
+// guard_sample - Is this the calling thread's sampled request? A thread's
+//                first countdown starts at a pseudo-random point below
+//                guard_rate, so its first request is sampled no more
+//                often than any other, and threads do not sample in step
+//
+static inline int guard_sample(void)
+{
+  if (!guard_seeded){
+    guard_seeded = 1;
+    // Knuth's multiplicative hash of the thread's arrival order
+    guard_countdown = ((atomic_fetch_add(&guard_threads, 1) + 1) * 2654435761u) %
+                      guard_rate;
+  }
+  if (guard_countdown > 0){
+    guard_countdown--;
+    return 0;
+  }
+  guard_countdown = guard_rate - 1;
+  return 1;
+}
+
+//
+// guard_init - Map the pool, all of it PROT_NONE. Caller holds guard_lock
+//
+static int guard_init(void)
+{
+  struct sigaction sa;
+  void *pool;
+
+  guard_page = mem_pagesize();
+  pool = mmap(NULL, (2*GUARD_SLOTS + 1) * guard_page, PROT_NONE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pool == MAP_FAILED){
+    return -1;
+  }
+  guard_pool = pool;
+  memset(guard_slots, 0, sizeof(guard_slots));
+  atomic_store(&guard_nretired, 0);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = guard_report;
+  sa.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &sa, &guard_oldsa);
+  return 0;
+}
+
+//
+// guard_reset - Unmap the pool along with the blocks of the old heap
+//
+static void guard_reset(void)
+{
+  pthread_mutex_lock(&guard_lock);
+  if (guard_pool != NULL){
+    munmap(guard_pool, (2*GUARD_SLOTS + 1) * guard_page);
+    guard_unhook();
+    guard_pool = NULL;
+  }
+  pthread_mutex_unlock(&guard_lock);
+}
+
+//
+// guard_malloc - Place a size byte block in the least recently freed
+//                slot. NULL if size is too big or every slot is live
+//
+static void *guard_malloc(uint32_t size)
+{
+  uint32_t payload = DSIZE * ((MAX(size, 1) + DSIZE - 1) / DSIZE);
+  guard_slot_t *slot = NULL;
+  char *page;
+  int i;
+
+  pthread_mutex_lock(&guard_lock);
+  if ((guard_pool == NULL && guard_init() < 0) ||
+      payload + WSIZE > guard_page){
+    pthread_mutex_unlock(&guard_lock);
+    return NULL;
+  }
+  for (i = 0; i < GUARD_SLOTS; i++){
+    if (!guard_slots[i].live &&
+        (slot == NULL || guard_slots[i].freed < slot->freed)){
+      slot = &guard_slots[i];
+    }
+  }
+  if (slot == NULL){
+    pthread_mutex_unlock(&guard_lock);
+    return NULL;
+  }
+
+  page = guard_pool + (2*(slot - guard_slots) + 1) * guard_page;
+  if (mprotect(page, guard_page, PROT_READ | PROT_WRITE) < 0){
+    pthread_mutex_unlock(&guard_lock);
+    return NULL;
+  }
+  slot->bp = page + guard_page - payload;
+  slot->size = size;
+  slot->live = 1;
+  // No footer: it would sit in the guard page, and nothing reads it
+  PUT(HDRP(slot->bp), PACK(payload + OVERHEAD, 1));
+  pthread_mutex_unlock(&guard_lock);
+  return slot->bp;
+}
+
+//
+// guard_slot - The slot of live guarded block bp. Aborts on a pointer
+//              that is not one: a double or invalid free. Caller holds
+//              guard_lock
+//
+static guard_slot_t *guard_slot(void *bp)
+{
+  guard_slot_t *slot = NULL;
+  size_t page;
+
+  page = ((char *)bp - guard_pool) / guard_page;
+  if (page % 2 == 1){
+    slot = &guard_slots[page / 2];
+  }
+  if (slot == NULL || slot->bp != bp || !slot->live || slot->retired){
+    fprintf(stderr, "mm: %s of guarded block %p\n",
+            slot != NULL && slot->bp == bp ? "double free" : "invalid free", bp);
+    abort();
+  }
+  return slot;
+}
+
+//
+// guard_quarantine - Make the slot's page PROT_NONE until it is reused.
+//                    Caller holds guard_lock
+//
+static void guard_quarantine(guard_slot_t *slot)
+{
+  slot->live = 0;
+  slot->retired = 0;
+  slot->freed = ++guard_clock;
+  mprotect(slot->bp - ((uintptr_t)slot->bp & (guard_page - 1)), guard_page, PROT_NONE);
+}
+
+//
+// guard_free - Put a guarded block's slot in quarantine
+//
+static void guard_free(void *bp)
+{
+  pthread_mutex_lock(&guard_lock);
+  guard_quarantine(guard_slot(bp));
+  pthread_mutex_unlock(&guard_lock);
+}
+
+//
+// guard_retire - mm_retire for a guarded block: the slot stays live,
+//                marked with epoch e, until guard_reclaim frees it
+//
+static void guard_retire(void *bp, unsigned int e)
+{
+  guard_slot_t *slot;
+
+  pthread_mutex_lock(&guard_lock);
+  slot = guard_slot(bp);
+  slot->retired = 1;
+  slot->retire_epoch = e;
+  atomic_fetch_add(&guard_nretired, 1);
+  pthread_mutex_unlock(&guard_lock);
+}
+
+//
+// guard_reclaim - Quarantine the retired slots two epochs older than e
+//
+static void guard_reclaim(unsigned int e)
+{
+  int i;
+
+  if (atomic_load_explicit(&guard_nretired, memory_order_relaxed) == 0){
+    return;
+  }
+  pthread_mutex_lock(&guard_lock);
+  for (i = 0; i < GUARD_SLOTS; i++){
+    if (guard_slots[i].retired && guard_slots[i].retire_epoch + 2 <= e){
+      guard_quarantine(&guard_slots[i]);
+      atomic_fetch_sub(&guard_nretired, 1);
+    }
+  }
+  pthread_mutex_unlock(&guard_lock);
+}
+
+//
+// mm_set_fit - Take the tightest of the first k fits from the rover
+//              (1 = next fit), adapt k to how well fits are going with
+//              MM_FIT_ADAPTIVE, or take the lowest fit with
+//              MM_FIT_ADDRESS. Call before mm_init
+//
+void mm_set_fit(int k)
+{
+  fit_k = k < MM_FIT_ADDRESS ? 1 : k;
+}
+
+//
+// mm_set_guard_rate - Serve one request in n from the guarded pool
+//                     (0 turns sampling off)
+//
+void mm_set_guard_rate(unsigned int n)
+{
+  guard_rate = n;
+}
+
+//
+// mm_is_guarded - Is ptr a block served from the guarded pool
+//
+int mm_is_guarded(void *ptr)
+{
+  return IS_GUARDED(ptr);
+}
+
+//
+// mm_guard_bytes - Bytes the guarded pool maps, or 0 while it is unmapped
+//
+size_t mm_guard_bytes(void)
+{
+  return guard_pool != NULL ? (2*GUARD_SLOTS + 1) * guard_page : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Memory budget
+//
+// With mm_set_limit the heap never grows past a fixed number of bytes.
+// When a request does not fit, heap_reclaim gives back everything mm
+// is holding on to before it gives up: the class stacks and deferred
+// frees are returned to the heap, free pages are purged and the
+// wilderness trimmed, and then the application's pressure callbacks
+// get a chance to free memory of their own.
+//
+
+//
+// heap_reclaim - Last try at an asize allocation after heap_malloc
+//                failed. Called and returns with heap_lock held, but
+//                drops it while the pressure callbacks run
+//
+static void *heap_reclaim(uint32_t asize)
+{
+  mm_pressure_fn fns[MAX_PRESSURE];
+  void *args[MAX_PRESSURE];
+  char *bp;
+  int i, n;
+
+  // Stop hoarding: every cached and deferred block goes back
+  for (i = 0; i < NSMALL; i++){
+    while ((bp = small_pop(i)) != NULL){
+      heap_free(bp);
+    }
+  }
+  drain_deferred();
+  purge_heap();
+  trim_heap();
+  if ((bp = heap_malloc(asize)) != NULL){
+    return bp;
+  }
+
+  // Ask the application, without the lock so the callbacks can free
+  for (i = n = 0; i < MAX_PRESSURE; i++){
+    if (pressure_cbs[i].fn != NULL){
+      fns[n] = pressure_cbs[i].fn;
+      args[n++] = pressure_cbs[i].arg;
+    }
+  }
+  if (n == 0){
+    return NULL;
+  }
+  pthread_mutex_unlock(&heap_lock);
+  for (i = 0; i < n; i++){
+    fns[i](asize - OVERHEAD, args[i]);
+  }
+  mm_free_async_flush();
+  pthread_mutex_lock(&heap_lock);
+  return heap_malloc(asize);
+}
+
+//
+// mm_set_limit - Cap the heap at bytes (0 removes the cap). A request
+//                that would grow the heap past it returns NULL once
+//                reclaiming has failed. Lowering the cap below the
+//                current heap size only stops further growth
+//
+void mm_set_limit(size_t bytes)
+{
+  pthread_mutex_lock(&heap_lock);
+  heap_limit = bytes;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// mm_add_pressure_callback - Have fn(request, arg) called when a request
+//                            of request bytes cannot be met within the
+//                            budget. Returns -1 if the table is full
+//
+int mm_add_pressure_callback(mm_pressure_fn fn, void *arg)
+{
+  int i;
+
+  pthread_mutex_lock(&heap_lock);
+  for (i = 0; i < MAX_PRESSURE && pressure_cbs[i].fn != NULL; i++){
+  }
+  if (i < MAX_PRESSURE){
+    pressure_cbs[i].fn = fn;
+    pressure_cbs[i].arg = arg;
+  }
+  pthread_mutex_unlock(&heap_lock);
+  return i < MAX_PRESSURE ? 0 : -1;
+}
+
+//
+// mm_remove_pressure_callback - Undo mm_add_pressure_callback(fn, arg)
+//
+void mm_remove_pressure_callback(mm_pressure_fn fn, void *arg)
+{
+  int i;
+
+  pthread_mutex_lock(&heap_lock);
+  for (i = 0; i < MAX_PRESSURE; i++){
+    if (pressure_cbs[i].fn == fn && pressure_cbs[i].arg == arg){
+      pressure_cbs[i].fn = NULL;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Asynchronous frees
+//
+// mm_free_async appends the pointer to a per-thread buffer and returns.
+// The buffer is flushed when it fills, on the thread's next mm_malloc,
+// on mm_free_async_flush and at thread exit. A flush sorts the batch by
+// address and frees it under a single heap_lock hold, so blocks that
+// sit next to each other coalesce back to back. While the maintenance
+// thread runs, a full buffer is handed to the deferred stack instead
+// and coalesced there.
+//
+
+//
+// sort_chain - Merge sort a chain of blocks linked through STACK_NEXT
+//              into address order and return the new head
+//
+static void *sort_chain(void *bp)
+{
+  char *slow, *fast, *a, *b;
+  uint32_t *tail;
+  uint32_t head = 0;
+
+  if (bp == NULL || STACK_NEXT(bp) == NULL){
+    return bp;
+  }
+
+  // Split the chain in two halves
+  slow = bp;
+  for (fast = STACK_NEXT(bp); fast != NULL && STACK_NEXT(fast) != NULL;
+       fast = STACK_NEXT(STACK_NEXT(fast))){
+    slow = STACK_NEXT(slow);
+  }
+  b = STACK_NEXT(slow);
+  *(uint32_t *)slow = 0;
+  a = sort_chain(bp);
+  b = sort_chain(b);
+
+  // Merge them, lowest address first
+  tail = &head;
+  while (a != NULL && b != NULL){
+    if (a < b){
+      *tail = OFFSET(a);
+      tail = (uint32_t *)a;
+      a = STACK_NEXT(a);
+    }
+    else {
+      *tail = OFFSET(b);
+      tail = (uint32_t *)b;
+      b = STACK_NEXT(b);
+    }
+  }
+  *tail = a != NULL ? OFFSET(a) : (b != NULL ? OFFSET(b) : 0);
+  return OFFSET_PTR(head);
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+  char *x = *(char * const *)a;
+  char *y = *(char * const *)b;
+
+  return (x > y) - (x < y);
+}
+
+//
+// async_flush - Free every pointer queued in ts
+//
+static void async_flush(thread_state_t *ts)
+{
+  int i, n = ts->nasync;
+  void *bp;
+
+  ts->nasync = 0;
+  if (ts->gen != atomic_load_explicit(&heap_gen, memory_order_relaxed)){
+    return;
+  }
+
+  if (atomic_load_explicit(&maint_running, memory_order_relaxed)){
+    for (i = 0; i < n; i++){
+      bp = ts->async[i];
+      if (!free_special(bp)){
+        stack_push(&deferred, bp);
+      }
+    }
+    mm_maint_kick();
+    return;
+  }
+
+  qsort(ts->async, n, sizeof(void *), ptr_cmp);
+  pthread_mutex_lock(&heap_lock);
+  for (i = 0; i < n; i++){
+    release(ts->async[i]);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// release - Free bp the way mm_free would, for a caller that already
+//           holds heap_lock: back to its run or guarded slot, onto its
+//           class stack or into the heap
+//
+static void release(void *bp)
+{
+  if (!free_special(bp) && !small_cache(bp)){
+    heap_free(bp);
+  }
+}
+
+//
+// free_chain - Free a chain of blocks linked through STACK_NEXT in
+//              address order under one heap_lock hold
+//
+static void free_chain(void *bp)
+{
+  char *next;
+
+  if (bp == NULL){
+    return;
+  }
+  pthread_mutex_lock(&heap_lock);
+  for (bp = sort_chain(bp); bp != NULL; bp = next){
+    next = STACK_NEXT(bp);
+    release(bp);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// mm_free_async - Queue bp to be freed later by this thread or the
+//                 maintenance thread
+//
+void mm_free_async(void *bp)
 {
-  void *newp;
-  uint32_t copySize;
+  thread_state_t *ts = my_state();
 
-  newp = mm_malloc(size);
-  if (newp == NULL) {
-    printf("ERROR: mm_malloc failed in mm_realloc\n");
-    exit(1);
+  ts->async[ts->nasync++] = bp;
+  if (ts->nasync == ASYNC_BATCH){
+    async_flush(ts);
   }
-  copySize = GET_SIZE(HDRP(ptr));
-  if (size < copySize) {
-    copySize = size;
+}
+
+//
+// mm_free_async_flush - Free this thread's queued pointers now
+//
+void mm_free_async_flush(void)
+{
+  if (thread_state.nasync > 0){
+    async_flush(&thread_state);
   }
-  memcpy(newp, ptr, copySize);
-  mm_free(ptr);
-  return newp;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Thread-owned runs
+//
+// In MM_SMALL_RUNS mode every small request is carved from, or recycled
+// within, a run owned by the calling thread (see run_t). A thread keeps
+// a list of runs per class. When none of them has a block left it
+// adopts a run abandoned by an exited thread, or takes a new one from
+// the heap.
+//
+
+//
+// run_new - Take a fresh run for blocks of asize bytes from the heap
+//
+static run_t *run_new(uint32_t asize)
+{
+  char *bp, *area;
+  run_t *run;
+
+  pthread_mutex_lock(&heap_lock);
+  if ((bp = heap_malloc(ASIZE(RUN_BYTES + 2*LINE))) == NULL){
+    bp = heap_reclaim(ASIZE(RUN_BYTES + 2*LINE));
+  }
+  pthread_mutex_unlock(&heap_lock);
+  if (bp == NULL){
+    return NULL;
+  }
+
+  // RUN on a heap block's tags marks it as a run (for mm_dump); runs
+  // are never freed, so mm_free never routes on it
+  PUT(HDRP(bp), GET(HDRP(bp)) | RUN);
+  PUT(FTRP(bp), GET(HDRP(bp)));
+
+  // run_t gets the first whole line, the block area the next RUN_BYTES
+  run = (run_t *)(((uintptr_t)bp + LINE - 1) & ~(uintptr_t)(LINE - 1));
+  area = (char *)run + LINE;
+  memset(run, 0, sizeof(run_t));
+  run->asize = asize;
+  // The first header goes one word in, so payloads are doubleword aligned
+  run->bump = OFFSET(area + WSIZE);
+  run->end = OFFSET(area + RUN_BYTES);
+  return run;
+}
+
+//
+// run_carve - Cut a new block from the unused end of run, or NULL if full
+//
+static void *run_carve(run_t *run)
+{
+  char *bp;
+
+  if (run->bump + run->asize > run->end){
+    return NULL;
+  }
+  bp = (char *)OFFSET_PTR(run->bump) + WSIZE;
+  run->bump += run->asize;
+  PUT(HDRP(bp), PACK(run->asize, 1) | RUN);
+  // The footer of a run block names its run instead of repeating the header
+  PUT(FTRP(bp), PACK(OFFSET(run), 1));
+  return bp;
+}
+
+//
+// run_malloc - Allocate a block of asize bytes from one of this
+//              thread's runs
+//
+static void *run_malloc(uint32_t asize)
+{
+  thread_state_t *ts = my_state();
+  int cls = asize/DSIZE;
+  uint32_t *prevp;
+  run_t *run;
+  char *bp;
+
+  for (prevp = &ts->runs[cls]; *prevp != 0; prevp = &run->next){
+    run = OFFSET_PTR(*prevp);
+    if ((bp = stack_pop(&run->free)) != NULL || (bp = run_carve(run)) != NULL){
+      // Move the run to the front so the next request looks here first
+      if (prevp != &ts->runs[cls]){
+        *prevp = run->next;
+        run->next = ts->runs[cls];
+        ts->runs[cls] = OFFSET(run);
+      }
+      return bp;
+    }
+  }
+
+  if ((run = stack_pop(&abandoned[cls])) == NULL &&
+      (run = run_new(asize)) == NULL){
+    return NULL;
+  }
+  run->next = ts->runs[cls];
+  ts->runs[cls] = OFFSET(run);
+  if ((bp = stack_pop(&run->free)) == NULL){
+    bp = run_carve(run);
+  }
+  // An adopted run can be full; a fresh one from the heap never is
+  return bp != NULL ? bp : run_malloc(asize);
+}
+
+//
+// run_free - Return a block to the run it was carved from
+//
+static void run_free(void *bp)
+{
+  run_t *run = OFFSET_PTR(GET(FTRP(bp)) & ~0x7);
+
+  stack_push(&run->free, bp);
+}
+
+//
+// thread_exit - Flush a thread's queued frees and abandon its runs so
+//               another thread can adopt them
+//
+static void thread_exit(void *arg)
+{
+  thread_state_t *ts = (thread_state_t *)arg;
+  uint32_t off, next;
+  int i;
+
+  async_flush(ts);
+  if (ts->gen != atomic_load_explicit(&heap_gen, memory_order_relaxed)){
+    return;
+  }
+  for (i = 0; i < NSMALL; i++){
+    for (off = ts->runs[i]; off != 0; off = next){
+      next = ((run_t *)OFFSET_PTR(off))->next;
+      stack_push(&abandoned[i], OFFSET_PTR(off));
+    }
+    ts->runs[i] = 0;
+  }
+
+  // Batches still waiting for their epoch become orphans
+  epoch_reclaim(ts);
+  for (i = 0; i < 3; i++){
+    for (off = ts->retired[i]; off != 0; off = next){
+      next = ((retire_batch_t *)OFFSET_PTR(off))->next;
+      stack_push(&orphans, OFFSET_PTR(off));
+    }
+    ts->retired[i] = 0;
+  }
+  if (ts->epoch_rec){
+    atomic_store(&epoch_recs[ts->epoch_rec - 1].active, 0);
+    atomic_store(&epoch_recs[ts->epoch_rec - 1].in_use, 0);
+  }
+}
+
+static void thread_key_init(void)
+{
+  pthread_key_create(&thread_key, thread_exit);
+}
+
+//
+// my_state - The calling thread's state, reset if it belongs to an
+//            older heap
+//
+static thread_state_t *my_state(void)
+{
+  thread_state_t *ts = &thread_state;
+  unsigned int gen = atomic_load_explicit(&heap_gen, memory_order_relaxed);
+
+  if (ts->gen != gen){
+    // Register for cleanup the first time this thread shows up
+    if (ts->gen == 0){
+      pthread_once(&thread_once, thread_key_init);
+      pthread_setspecific(thread_key, ts);
+    }
+    memset(ts, 0, sizeof(thread_state_t));
+    ts->gen = gen;
+  }
+  return ts;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Fork sealing
+//
+// With mm_set_fork_seal(1), a child of fork treats its copy of the
+// parent's heap as read-only. Freeing a parent block in the child sets a
+// bit in a private bitmap instead of writing tags and coalescing, so the
+// pages stay shared with the parent and every other child. The child's
+// own blocks come from heap grown past the seal; the parent's free
+// blocks, cached blocks and runs are never handed out again.
+//
+
+static void seal_prepare(void);
+static void seal_parent(void);
+static void seal_child(void);
+
+//
+// seal_register - Install the fork handlers, once per process
+//
+static void seal_register(void)
+{
+  pthread_atfork(seal_prepare, seal_parent, seal_child);
+}
+
+//
+// mm_set_fork_seal - Seal the heap in children forked from now on (1)
+//                    or leave them sharing it the ordinary way (0)
+//
+void mm_set_fork_seal(int on)
+{
+  fork_seal = on;
+  if (on){
+    pthread_once(&seal_once, seal_register);
+  }
+}
+
+//
+// seal_prepare, seal_parent - Hold heap_lock across fork, so the child
+//                             gets a heap no thread was halfway through
+//
+static void seal_prepare(void)
+{
+  pthread_mutex_lock(&heap_lock);
+}
+
+static void seal_parent(void)
+{
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// seal_child - Seal the child's copy of the heap at its current end
+//
+// Only the forking thread exists in the child, so everything the other
+// threads held (class stacks, runs, deferred and retired blocks, locks)
+// is dropped or reset. If the bitmap cannot be mapped the child carries
+// on unsealed.
+//
+static void seal_child(void)
+{
+  char *end = (char *)mem_heap_hi() + 1;   // bp of the epilogue
+  size_t bytes = (OFFSET(end) / DSIZE / (8 * sizeof(long)) + 1) * sizeof(long);
+  int i;
+
+  if (!fork_seal || heap_listp == NULL){
+    pthread_mutex_unlock(&heap_lock);
+    return;
+  }
+  if (seal_map != NULL){
+    munmap(seal_map, seal_map_bytes);
+  }
+  seal_map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (seal_map == MAP_FAILED){
+    seal_map = NULL;
+    pthread_mutex_unlock(&heap_lock);
+    return;
+  }
+  seal_map_bytes = bytes;
+
+  // Searches start past the seal and never reach below it
+  heap_floor = end;
+  next_fit = end;
+  free_list = NULL;
+  memset(side, 0, side_top * sizeof(side_t));
+  side_top = 0;
+
+  for (i = 0; i < NSMALL; i++){
+    atomic_store(&small_stacks[i].head, 0);
+    atomic_store(&small_stacks[i].count, 0);
+    atomic_store(&abandoned[i].head, 0);
+    atomic_store(&abandoned[i].count, 0);
+    pthread_mutex_init(&small_locks[i], NULL);
+  }
+  atomic_store(&deferred.head, 0);
+  atomic_store(&deferred.count, 0);
+  atomic_store(&orphans.head, 0);
+  atomic_store(&orphans.count, 0);
+  memset(epoch_recs, 0, sizeof(epoch_recs));
+  atomic_store(&epoch_nrecs, 0);
+  atomic_store(&maint_running, 0);
+  pthread_mutex_init(&maint_lock, NULL);
+  pthread_cond_init(&maint_cond, NULL);
+  pthread_mutex_init(&guard_lock, NULL);
+  // This thread's runs, async queue and retired chains go with the gen
+  atomic_fetch_add(&heap_gen, 1);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+//
+// seal_free - Mark the sealed block bp free without touching its pages
+//
+static void seal_free(void *bp)
+{
+  uint32_t bit = OFFSET(bp) / DSIZE;
+  unsigned long mask = 1UL << (bit % (8 * sizeof(long)));
+
+  if (atomic_fetch_or(&seal_map[bit / (8 * sizeof(long))], mask) & mask){
+    fprintf(stderr, "mm: double free of sealed block %p\n", bp);
+    abort();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Epoch-based reclamation
+//
+// For lock-free structures built on mm: readers bracket every access
+// with mm_epoch_enter/mm_epoch_exit, and a writer that unlinks a node
+// passes it to mm_retire instead of mm_free. Retired blocks are listed
+// in retire batches, chained per thread in three chains by epoch, and
+// are freed in address-sorted batches (free_chain) once the epoch has
+// moved two steps past them, so small ones land straight back in their
+// run or class stack.
+//
+
+//
+// epoch_advance - Move the global epoch on if every thread inside an
+//                 epoch section has seen the current one
+//
+static void epoch_advance(void)
+{
+  unsigned int e = atomic_load(&global_epoch);
+  int i, n = atomic_load(&epoch_nrecs);
+
+  for (i = 0; i < n; i++){
+    if (atomic_load(&epoch_recs[i].in_use) && atomic_load(&epoch_recs[i].active) &&
+        atomic_load(&epoch_recs[i].epoch) != e){
+      return;
+    }
+  }
+  // Losing this race means somebody else advanced it
+  atomic_compare_exchange_strong(&global_epoch, &e, e + 1);
+}
+
+//
+// epoch_reclaim - Free the retired chains of ts (if any) and the orphans
+//                 that are two epochs old
+//
+static void epoch_reclaim(thread_state_t *ts)
+{
+  unsigned int e = atomic_load(&global_epoch);
+  retire_batch_t *b, *ready = NULL;
+  char *next;
+  int i;
+
+  if (ts != NULL){
+    for (i = 0; i < 3; i++){
+      if (ts->retired[i] != 0 && ts->retired_epoch[i] + 2 <= e){
+        retire_free(OFFSET_PTR(ts->retired[i]));
+        ts->retired[i] = 0;
+      }
+    }
+  }
+
+  // The orphans stack links batches through their next word
+  for (b = stack_take(&orphans); b != NULL; b = (retire_batch_t *)next){
+    next = STACK_NEXT(b);
+    if (b->epoch + 2 <= e){
+      b->next = ready != NULL ? OFFSET(ready) : 0;
+      ready = b;
+    }
+    else {
+      stack_push(&orphans, b);
+    }
+  }
+  retire_free(ready);
+  guard_reclaim(e);
+}
+
+//
+// retire_free - Free the blocks listed in a chain of retire batches,
+//               and the batches along with them
+//
+// Nobody can reach the blocks any more, so only now are they linked
+// through their first payload word for free_chain.
+//
+static void retire_free(retire_batch_t *b)
+{
+  uint32_t chain = 0, i;
+  retire_batch_t *next;
+
+  for (; b != NULL; b = next){
+    next = OFFSET_PTR(b->next);
+    for (i = 0; i < b->n; i++){
+      *(uint32_t *)OFFSET_PTR(b->bp[i]) = chain;
+      chain = b->bp[i];
+    }
+    b->next = chain;
+    chain = OFFSET(b);
+  }
+  free_chain(OFFSET_PTR(chain));
+}
+
+//
+// mm_epoch_enter - Start a section in which blocks retired by other
+//                  threads stay valid. Sections nest. Returns -1 if
+//                  MAX_THREADS threads already have a record
+//
+int mm_epoch_enter(void)
+{
+  thread_state_t *ts = my_state();
+  epoch_rec_t *rec;
+  int i, expect;
+
+  if (ts->epoch_rec == 0){
+    for (i = 0; i < MAX_THREADS; i++){
+      expect = 0;
+      if (atomic_compare_exchange_strong(&epoch_recs[i].in_use, &expect, 1)){
+        break;
+      }
+    }
+    if (i == MAX_THREADS){
+      return -1;
+    }
+    ts->epoch_rec = i + 1;
+    // Make sure epoch_advance scans as far as our slot
+    for (expect = atomic_load(&epoch_nrecs); expect < i + 1 &&
+         !atomic_compare_exchange_weak(&epoch_nrecs, &expect, i + 1); ){
+    }
+  }
+
+  if (ts->epoch_depth++ == 0){
+    rec = &epoch_recs[ts->epoch_rec - 1];
+    atomic_store(&rec->active, 1);
+    atomic_store(&rec->epoch, atomic_load(&global_epoch));
+  }
+  return 0;
+}
+
+//
+// mm_epoch_exit - End the section started by the matching mm_epoch_enter
+//
+void mm_epoch_exit(void)
+{
+  thread_state_t *ts = &thread_state;
+
+  if (ts->epoch_depth > 0 && --ts->epoch_depth == 0){
+    atomic_store(&epoch_recs[ts->epoch_rec - 1].active, 0);
+  }
+}
+
+//
+// mm_retire - Free bp once no thread can still be inside an epoch
+//             section that started before this call
+//
+void mm_retire(void *bp)
+{
+  thread_state_t *ts = my_state();
+  unsigned int e = atomic_load(&global_epoch);
+  int i = e % 3;
+  retire_batch_t *b, *nb;
+
+  // A sealed block is never handed out again, so it needs no grace period
+  if (IS_SEALED(bp)){
+    seal_free(bp);
+    return;
+  }
+
+  // A guarded block may lie anywhere in the address space, out of reach
+  // of the offset-linked chains; it waits in its slot instead
+  if (IS_GUARDED(bp)){
+    guard_retire(bp, e);
+    return;
+  }
+
+  // A chain in this slot is from epoch e - 3 or earlier, so it is safe
+  if (ts->retired[i] != 0 && ts->retired_epoch[i] != e){
+    retire_free(OFFSET_PTR(ts->retired[i]));
+    ts->retired[i] = 0;
+  }
+  ts->retired_epoch[i] = e;
+
+  b = OFFSET_PTR(ts->retired[i]);
+  if (b == NULL || b->n == RETIRE_BATCH){
+    pthread_mutex_lock(&heap_lock);
+    nb = heap_malloc(ASIZE(sizeof(retire_batch_t)));
+    pthread_mutex_unlock(&heap_lock);
+    // Out of heap, the block is never freed: leaking it is safe, and
+    // freeing it early or writing a link into it is not
+    if (nb == NULL){
+      return;
+    }
+    nb->next = ts->retired[i];
+    nb->epoch = e;
+    nb->n = 0;
+    ts->retired[i] = OFFSET(nb);
+    b = nb;
+  }
+  b->bp[b->n++] = OFFSET(bp);
+
+  if (++ts->nretired >= RETIRE_BATCH){
+    ts->nretired = 0;
+    epoch_advance();
+    epoch_reclaim(ts);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Heap snapshots
+//
+// mm_dump writes the block map described in mm.h: every block of the
+// boundary-tag heap in address order, each run followed by the blocks
+// carved from it, and the regions the heap is made of. The map is
+// taken under heap_lock, and which stack a block is on is found by
+// walking the stacks, so a block passing through a lock-free stack
+// meanwhile may show its previous state. Blocks still in a thread's
+// mm_free_async buffer or retired chains show as allocated. The map is
+// built in pages of its own rather than with malloc, which may be this
+// allocator and would deadlock on heap_lock.
+//
+
+//
+// dump_blocks - Fill in up to max records for the heap's blocks, and
+//               return how many there are (blocks may be NULL to count)
+//
+static uint32_t dump_blocks(mm_dump_block_t *blocks, uint32_t max)
+{
+  mm_dump_block_t rec;
+  uint32_t n = 0, off, hdr, bit;
+  char *bp, *area;
+  run_t *run;
+
+  for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+    hdr = GET(HDRP(bp));
+    rec.offset = OFFSET(bp);
+    rec.size = GET_SIZE(HDRP(bp));
+    rec.flags = IS_SEALED(bp) ? MM_DUMP_SEALED : 0;
+    if (!GET_ALLOC(HDRP(bp))){
+      rec.state = IS_SEALED(bp) ? MM_DUMP_DEAD : MM_DUMP_FREE;
+      rec.flags |= (hdr & PURGED) ? MM_DUMP_PURGED : 0;
+    } else if (hdr & RUN){
+      rec.state = MM_DUMP_RUN;
+    } else {
+      rec.state = MM_DUMP_ALLOC;
+    }
+    if (blocks != NULL && n < max){
+      blocks[n] = rec;
+    }
+    n++;
+    if (rec.state != MM_DUMP_RUN){
+      continue;
+    }
+
+    // The blocks carved so far; a run's owner carves without heap_lock
+    run = (run_t *)(((uintptr_t)bp + LINE - 1) & ~(uintptr_t)(LINE - 1));
+    area = (char *)run + LINE;
+    for (off = OFFSET(area + WSIZE); off + run->asize <= run->bump; off += run->asize){
+      if (blocks != NULL && n < max){
+        blocks[n].offset = off + WSIZE;
+        blocks[n].size = run->asize;
+        blocks[n].state = MM_DUMP_ALLOC;
+        blocks[n].flags = MM_DUMP_CARVED | (rec.flags & MM_DUMP_SEALED);
+      }
+      n++;
+    }
+  }
+
+  // Sealed blocks freed in this child are marked in seal_map only
+  for (off = 0; blocks != NULL && seal_map != NULL && off < n && off < max; off++){
+    bit = blocks[off].offset / DSIZE;
+    if ((blocks[off].flags & MM_DUMP_SEALED) &&
+        (atomic_load(&seal_map[bit / (8 * sizeof(long))]) &
+         (1UL << (bit % (8 * sizeof(long)))))){
+      blocks[off].state = MM_DUMP_DEAD;
+    }
+  }
+  return n;
+}
+
+//
+// dump_stack - Give every block on stack st the state given. The
+//              blocks are found by offset in the sorted map
+//
+static void dump_stack(mm_dump_block_t *blocks, uint32_t n,
+                       block_stack_t *st, uint16_t state)
+{
+  uint32_t i, lo, hi, mid, off;
+  char *bp = OFFSET_PTR((uint32_t)atomic_load(&st->head));
+
+  // No stack holds more blocks than there are; a longer walk is stale
+  for (i = 0; bp != NULL && i < n; i++, bp = STACK_NEXT(bp)){
+    off = OFFSET(bp);
+    for (lo = 0, hi = n; lo < hi; ){
+      mid = lo + (hi - lo) / 2;
+      if (blocks[mid].offset < off){
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == n || blocks[lo].offset != off){
+      return;
+    }
+    blocks[lo].state = state;
+  }
+}
+
+//
+// mm_dump - Write a snapshot of the heap's block map to path
+//
+int mm_dump(const char *path)
+{
+  mm_dump_hdr_t hdr;
+  mm_dump_block_t *blocks;
+  mm_dump_region_t *regions;
+  uint32_t i, n, nr = 0;
+  size_t bytes = 0;
+  void *map = MAP_FAILED;
+  run_t *run;
+  FILE *fp;
+  int ok;
+
+  pthread_mutex_lock(&heap_lock);
+  if (heap_listp != NULL){
+    // Room for a few blocks carved while the map is allocated, and for
+    // the heap and sealed regions and one per run
+    n = dump_blocks(NULL, 0) + 64;
+    bytes = n * sizeof(mm_dump_block_t) + (n + 2) * sizeof(mm_dump_region_t);
+    map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (map == MAP_FAILED){
+    pthread_mutex_unlock(&heap_lock);
+    return -1;
+  }
+  blocks = map;
+  regions = (mm_dump_region_t *)(blocks + n);
+  if ((i = dump_blocks(blocks, n)) < n){
+    n = i;
+  }
+
+  for (i = 0; i < NSMALL; i++){
+    dump_stack(blocks, n, &small_stacks[i], MM_DUMP_CACHED);
+  }
+  dump_stack(blocks, n, &deferred, MM_DUMP_DEFERRED);
+  dump_stack(blocks, n, &orphans, MM_DUMP_DEFERRED);
+
+  regions[nr].offset = 0;
+  regions[nr].size = mem_heapsize();
+  regions[nr++].kind = MM_REGION_HEAP;
+  if (seal_map != NULL){
+    regions[nr].offset = 0;
+    regions[nr].size = OFFSET(heap_floor);
+    regions[nr++].kind = MM_REGION_SEALED;
+  }
+  for (i = 0; i < n; i++){
+    if (blocks[i].state == MM_DUMP_RUN){
+      run = (run_t *)(((uintptr_t)OFFSET_PTR(blocks[i].offset) + LINE - 1) &
+                      ~(uintptr_t)(LINE - 1));
+      dump_stack(blocks, n, &run->free, MM_DUMP_RUN_FREE);
+      regions[nr].offset = OFFSET((char *)run + LINE);
+      regions[nr].size = RUN_BYTES;
+      regions[nr++].kind = MM_REGION_RUN;
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = MM_DUMP_MAGIC;
+  hdr.version = MM_DUMP_VERSION;
+  hdr.heap_addr = (uintptr_t)heap_base;
+  hdr.heap_size = mem_heapsize();
+  hdr.heap_limit = heap_limit;
+  hdr.page_size = mem_pagesize();
+  hdr.nregions = nr;
+  hdr.nblocks = n;
+  pthread_mutex_unlock(&heap_lock);
+
+  ok = (fp = fopen(path, "wb")) != NULL &&
+       fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+       fwrite(regions, sizeof(mm_dump_region_t), nr, fp) == nr &&
+       fwrite(blocks, sizeof(mm_dump_block_t), n, fp) == n;
+  if (fp != NULL && fclose(fp) != 0){
+    ok = 0;
+  }
+  munmap(map, bytes);
+  return ok ? 0 : -1;
 }
 
 //
@@ -416,6 +3361,8 @@ void mm_checkheap(int verbose)
   // and provide your own mm_checkheap
   //
   void *bp = heap_listp;
+  char *fp, *pred = NULL;
+  int nfree = 0;
   
   if (verbose) {
     printf("Heap (%p):\n", heap_listp);
@@ -431,6 +3378,9 @@ void mm_checkheap(int verbose)
       printblock(bp);
     }
     checkblock(bp);
+    if (!GET_ALLOC(HDRP(bp)) && !IS_SEALED(bp)) {
+      nfree++;
+    }
   }
      
   if (verbose) {
@@ -440,6 +3390,23 @@ void mm_checkheap(int verbose)
   if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
     printf("Bad epilogue header\n");
   }
+
+  // Every free block must be on the free list, in address order
+  for (fp = free_list; fp != NULL; pred = fp, fp = FREE_SUCC(fp)) {
+    if (GET_ALLOC(HDRP(fp)) || FREE_PRED(fp) != pred || fp <= pred) {
+      printf("Error: bad free list entry %p\n", fp);
+      return;
+    }
+    if (side[CHUNK(fp)].max < GET_SIZE(HDRP(fp)) ||
+        ((pred == NULL || CHUNK(pred) != CHUNK(fp)) &&
+         side[CHUNK(fp)].first != OFFSET(fp))) {
+      printf("Error: side table entry of chunk %u is stale\n", CHUNK(fp));
+    }
+    nfree--;
+  }
+  if (nfree != 0) {
+    printf("Error: %d free blocks not on the free list\n", nfree);
+  }
 }
 
 static void printblock(void *bp) 
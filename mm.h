@@ -1,10 +1,147 @@
+#ifndef MM_H
+#define MM_H
+
 #include <stdio.h>
 #include <stdint.h>
 
 extern int mm_init (void);
+extern int mm_init_hint(size_t expected_bytes, const uint32_t *hist);
 extern void *mm_malloc (uint32_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, uint32_t size);
+extern void mm_free_async(void *ptr);
+extern void mm_free_async_flush(void);
+
+/* How mm_realloc moved payloads */
+typedef struct {
+    unsigned long bytes_copied;    /* moved with memcpy */
+    unsigned long bytes_remapped;  /* moved as whole pages with mremap */
+} mm_realloc_stats_t;
+
+extern void mm_realloc_stats(mm_realloc_stats_t *stats);
+
+/* Payload bytes a block really has, and that a request of size bytes
+   would get; callers can grow into the difference without mm_realloc */
+extern uint32_t mm_malloc_usable_size(void *ptr);
+extern uint32_t mm_good_size(uint32_t size);
+
+/* Grow a block in place toward max_size bytes, to at least min_size;
+   returns its new usable size, or 0 if it would have to move */
+extern uint32_t mm_expand(void *ptr, uint32_t min_size, uint32_t max_size);
+
+/* Leave the parent's heap pages untouched in forked children (0 = off) */
+extern void mm_set_fork_seal(int on);
+
+/* Sample one request in n into guard-paged slots (0 = off). The slots
+   are mapped outside the memlib heap; mm_is_guarded tells them apart
+   and mm_guard_bytes is the size of their mapping (0 if not mapped) */
+extern void mm_set_guard_rate(unsigned int n);
+extern int mm_is_guarded(void *ptr);
+extern size_t mm_guard_bytes(void);
+
+/* Memory budget; callbacks get the payload size that did not fit */
+typedef void (*mm_pressure_fn)(size_t request, void *arg);
+
+extern void mm_set_limit(size_t bytes);
+extern int mm_add_pressure_callback(mm_pressure_fn fn, void *arg);
+extern void mm_remove_pressure_callback(mm_pressure_fn fn, void *arg);
+
+/* Epoch-based deferred reclamation for lock-free structures */
+extern int mm_epoch_enter(void);
+extern void mm_epoch_exit(void);
+extern void mm_retire(void *ptr);
+
+/* Placement: tightest of the first k fits (1 = next fit), adaptive k,
+   or address-ordered first fit */
+#define MM_FIT_ADAPTIVE 0
+#define MM_FIT_ADDRESS  (-1)
+extern void mm_set_fit(int k);
+
+/* Small-class entry points for callers that know the class up front.
+   A request of size bytes has class MM_CLASS(size) and can use them if
+   that is at most MM_SMALL_MAX/8 */
+#define MM_SMALL_MAX 128   /* largest block (bytes) in the small-class cache */
+#define MM_CLASS(size) ((size) <= 8 ? 2 : ((size) + 15) / 8)
+
+extern void *mm_malloc_class(int cls);
+extern void mm_free_class(void *ptr, int cls);
+
+/* Small-class cache modes for mm_set_small_mode() */
+#define MM_SMALL_OFF      0   /* every block goes through the heap */
+#define MM_SMALL_LOCKED   1   /* per-class lists behind a mutex */
+#define MM_SMALL_LOCKFREE 2   /* per-class Treiber stacks (default) */
+#define MM_SMALL_RUNS     3   /* per-thread runs, no shared cache lines */
+
+extern void mm_set_small_mode(int mode, int refill);
+
+/* Work done by the background maintenance thread */
+typedef struct {
+    unsigned long passes;          /* maintenance passes run */
+    unsigned long deferred_frees;  /* frees coalesced off the mm_free path */
+    unsigned long cache_flushed;   /* small blocks returned to the heap */
+    unsigned long pages_purged;    /* free pages given back with madvise */
+    unsigned long bytes_trimmed;   /* bytes released by shrinking the heap */
+} mm_maint_stats_t;
+
+extern int mm_maint_start(unsigned int period_ms);
+extern void mm_maint_stop(void);
+extern void mm_maint_kick(void);
+extern void mm_maint_stats(mm_maint_stats_t *stats);
+
+/* Heap snapshots. mm_dump(path) writes an mm_dump_hdr_t, nregions
+   mm_dump_region_t and nblocks mm_dump_block_t in native byte order,
+   and no payload bytes; returns 0, or -1 with errno set. Offsets are
+   from the start of the heap. mmdump reads the file */
+#define MM_DUMP_MAGIC   0x706d646d  /* "mdmp" */
+#define MM_DUMP_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t heap_addr;    /* where the heap starts in the process */
+    uint64_t heap_size;    /* bytes the heap spans */
+    uint64_t heap_limit;   /* mm_set_limit budget (0 = none) */
+    uint32_t page_size;
+    uint32_t nregions;
+    uint32_t nblocks;
+    uint32_t pad;
+} mm_dump_hdr_t;
+
+/* Regions */
+#define MM_REGION_HEAP   0  /* the whole heap */
+#define MM_REGION_SEALED 1  /* the parent's heap in a sealed child */
+#define MM_REGION_RUN    2  /* block area of a thread-owned run */
+#define MM_REGION_NKINDS 3
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t kind;
+} mm_dump_region_t;
+
+/* Block states */
+#define MM_DUMP_ALLOC    0  /* in use */
+#define MM_DUMP_FREE     1  /* on the free list */
+#define MM_DUMP_CACHED   2  /* freed onto its small-class stack */
+#define MM_DUMP_DEFERRED 3  /* freed, waiting for maintenance or its epoch */
+#define MM_DUMP_RUN      4  /* holds a run; its carved blocks follow it */
+#define MM_DUMP_RUN_FREE 5  /* carved from a run and freed back to it */
+#define MM_DUMP_DEAD     6  /* freed in a sealed child, never reused */
+#define MM_DUMP_NSTATES  7
+
+/* Block flags */
+#define MM_DUMP_PURGED   0x1  /* free, with its interior pages given back */
+#define MM_DUMP_CARVED   0x2  /* inside a run rather than a heap block */
+#define MM_DUMP_SEALED   0x4  /* part of the parent's heap in a sealed child */
+
+typedef struct {
+    uint32_t offset;       /* of the payload */
+    uint32_t size;         /* of the block, header and footer included */
+    uint16_t state;
+    uint16_t flags;
+} mm_dump_block_t;
+
+extern int mm_dump(const char *path);
 
 
 /* 
@@ -22,3 +159,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* MM_H */
@@ -0,0 +1,66 @@
+/*
+ * mm.hpp - C++ front end to the mm package
+ *
+ * mm::alloc<N>() and mm::free<N>(p) work out the small-class index of an
+ * N-byte request at compile time. Requests that fit the small-class
+ * cache go straight to mm_malloc_class/mm_free_class with a constant
+ * class; larger ones are plain mm_malloc/mm_free calls. N is nearly
+ * always sizeof(T), which mm::create<T> and mm::destroy<T> supply.
+ */
+#ifndef MM_HPP
+#define MM_HPP
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+extern "C" {
+#include "mm.h"
+}
+
+namespace mm {
+
+/* Small-class index of an N-byte request, or 0 if it is too big */
+template <std::size_t N>
+constexpr int size_class()
+{
+    return MM_CLASS(N) <= MM_SMALL_MAX / 8 ? (int)MM_CLASS(N) : 0;
+}
+
+template <std::size_t N>
+inline void *alloc()
+{
+    static_assert(N > 0, "mm::alloc of zero bytes");
+    return size_class<N>() ? mm_malloc_class(size_class<N>())
+                           : mm_malloc((uint32_t)N);
+}
+
+template <std::size_t N>
+inline void free(void *p)
+{
+    if (size_class<N>())
+        mm_free_class(p, size_class<N>());
+    else
+        mm_free(p);
+}
+
+/* Construct a T in an mm block; NULL if the block cannot be had */
+template <class T, class... Args>
+inline T *create(Args&&... args)
+{
+    void *p = alloc<sizeof(T)>();
+    return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+}
+
+template <class T>
+inline void destroy(T *p)
+{
+    if (p) {
+        p->~T();
+        free<sizeof(T)>(p);
+    }
+}
+
+} // namespace mm
+
+#endif /* MM_HPP */
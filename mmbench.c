@@ -0,0 +1,792 @@
+/*
+ * mmbench.c - Trace replay library behind mdriver
+ *
+ * Trace loading, the checked, util and timed replays, and the payload
+ * range list, factored out of mdriver.c so that any harness can run an
+ * allocator over a trace and get the numbers back as a struct. See
+ * mmbench.h for the interface.
+ *
+ * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
+ * May not be used, modified, or copied without permission.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <float.h>
+#include <sys/time.h>
+
+#include "mmbench.h"
+#include "memlib.h"
+#include "fsecs.h"
+#include "config.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+/* Misc */
+#define MAXLINE     1024 /* max string size */
+#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+
+/* Returns true if p is ALIGNMENT-byte aligned */
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
+
+/* Records the extent of each block's payload */
+typedef struct range_t {
+    char *lo;              /* low payload address */
+    char *hi;              /* high payload address */
+    struct range_t *next;  /* next list element */
+} range_t;
+
+/*
+ * Holds the params to eval_speed, which is timed by fcyc. This struct
+ * is necessary because fcyc accepts only a pointer array as input.
+ */
+typedef struct {
+    const mmb_alloc_t *alloc;
+    mmb_trace_t *trace;
+    int nops;        /* requests to replay from the start of the trace */
+    const mmb_opts_t *opts;
+    int failed;      /* a request failed, and the replays stopped */
+    int split;       /* time the requests before this one apart (0 = no;
+			otherwise 1..nops) */
+    double part[2];  /* fastest replay time before and from split */
+} speed_t;
+
+/********************
+ * Global variables
+ *******************/
+int mmb_verbose = 0;    /* global flag for verbose output */
+static int timer_ready = 0;  /* init_fsecs has been called */
+
+/*********************
+ * Function prototypes
+ *********************/
+
+/* these functions manipulate range lists */
+static int add_range(range_t **ranges, char *lo, int size,
+		     const mmb_alloc_t *alloc, int tracenum, int opnum);
+static void remove_range(range_t **ranges, char *lo);
+static void clear_ranges(range_t **ranges);
+
+static int start(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		 const mmb_opts_t *opts);
+static int eval_valid(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		      int tracenum, range_t **ranges);
+static void eval_speed(void *ptr);
+static double now(void);
+static void malloc_error(int tracenum, int opnum, const char *msg);
+
+/*
+ * The C library's package, behind the uint32_t signatures of the table
+ */
+static void *libc_malloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+static void *libc_realloc(void *ptr, uint32_t size)
+{
+    return realloc(ptr, size);
+}
+
+const mmb_alloc_t mmb_libc = {
+    "libc", NULL, NULL, libc_malloc, free, libc_realloc, 0
+};
+
+
+/*****************************************************************
+ * The following routines manipulate the range list, which keeps
+ * track of the extent of every allocated block payload. We use the
+ * range list to detect any overlapping allocated blocks.
+ ****************************************************************/
+
+/*
+ * add_range - As directed by request opnum in trace tracenum,
+ *     we've just called the allocator to allocate a block of size
+ *     bytes at addr lo. After checking the block for correctness,
+ *     we create a range struct for this block and add it to the range list.
+ *     Only a memlib allocator has to stay inside the memlib heap, and
+ *     then only with the payloads it does not say are kept elsewhere.
+ */
+static int add_range(range_t **ranges, char *lo, int size,
+		     const mmb_alloc_t *alloc, int tracenum, int opnum)
+{
+    char *hi = lo + size - 1;
+    range_t *p;
+    char msg[MAXLINE];
+
+    if (size <= 0) {
+	malloc_error(tracenum, opnum, "Request of a non-positive size");
+	return 0;
+    }
+
+    /* Payload addresses must be ALIGNMENT-byte aligned */
+    if (!IS_ALIGNED(lo)) {
+	sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+		lo, ALIGNMENT);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
+    }
+
+    /* The payload must lie within the extent of the heap */
+    if (alloc->memlib && (alloc->off_heap == NULL || !alloc->off_heap(lo)) &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+		lo, hi, mem_heap_lo(), mem_heap_hi());
+	malloc_error(tracenum, opnum, msg);
+        return 0;
+    }
+
+    /* The payload must not overlap any other payloads */
+    for (p = *ranges;  p != NULL;  p = p->next) {
+        if ((lo >= p->lo && lo <= p-> hi) ||
+            (hi >= p->lo && hi <= p->hi)) {
+	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		    lo, hi, p->lo, p->hi);
+	    malloc_error(tracenum, opnum, msg);
+	    return 0;
+        }
+    }
+
+    /*
+     * Everything looks OK, so remember the extent of this block
+     * by creating a range struct and adding it the range list.
+     */
+    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL) {
+	malloc_error(tracenum, opnum, "malloc error in add_range");
+	return 0;
+    }
+    p->next = *ranges;
+    p->lo = lo;
+    p->hi = hi;
+    *ranges = p;
+    return 1;
+}
+
+/*
+ * remove_range - Free the range record of block whose payload starts at lo
+ */
+static void remove_range(range_t **ranges, char *lo)
+{
+    range_t *p;
+    range_t **prevpp = ranges;
+
+    for (p = *ranges;  p != NULL; p = p->next) {
+        if (p->lo == lo) {
+	    *prevpp = p->next;
+            free(p);
+            break;
+        }
+        prevpp = &(p->next);
+    }
+}
+
+/*
+ * clear_ranges - free all of the range records for a trace
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_t *p;
+    range_t *pnext;
+
+    for (p = *ranges;  p != NULL;  p = pnext) {
+        pnext = p->next;
+        free(p);
+    }
+    *ranges = NULL;
+}
+
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * mmb_read_trace - read a trace file and store it in memory, or print
+ *     what is wrong with it and return NULL
+ */
+mmb_trace_t *mmb_read_trace(const char *tracedir, const char *filename)
+{
+    FILE *tracefile;
+    mmb_trace_t *trace;
+    char type[MAXLINE];
+    char path[MAXLINE];
+    const char *err = NULL;
+    int index, size;
+    int max_index = 0;
+    int op_index;
+
+    if (mmb_verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (mmb_trace_t *) calloc(1, sizeof(mmb_trace_t))) == NULL) {
+	printf("malloc 1 failed in mmb_read_trace\n");
+	return NULL;
+    }
+
+    /* Read the trace file header */
+    snprintf(path, sizeof(path), "%s%s", tracedir, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	printf("Could not open %s in mmb_read_trace: %s\n", path, strerror(errno));
+	free(trace);
+	return NULL;
+    }
+    if (fscanf(tracefile, "%d %d %d %d", &trace->sugg_heapsize,
+	       &trace->num_ids, &trace->num_ops, &trace->weight) != 4 ||
+	trace->num_ids < 0 || trace->num_ops < 0) {
+	err = "bad header";
+	goto out;
+    }
+
+    /* We'll store each request line in the trace in this array */
+    /* ... and keep an array of pointers to the allocated blocks here... */
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->ops =
+	 (mmb_op_t *)malloc((trace->num_ops + 1) * sizeof(mmb_op_t))) == NULL ||
+	(trace->blocks =
+	 (char **)malloc((trace->num_ids + 1) * sizeof(char *))) == NULL ||
+	(trace->block_sizes =
+	 (size_t *)malloc((trace->num_ids + 1) * sizeof(size_t))) == NULL) {
+	err = "out of memory";
+	goto out;
+    }
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	if (op_index == trace->num_ops) {
+	    err = "more requests than the header says";
+	    goto out;
+	}
+	switch(type[0]) {
+	case 'a':
+	case 'r':
+	    if (2 != fscanf(tracefile, "%d %d", &index, &size)) {
+		err = "bad alloc or realloc request";
+		goto out;
+	    }
+	    trace->ops[op_index].type = type[0] == 'a' ? MMB_ALLOC : MMB_REALLOC;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    if (type[0] == 'a' && size > 0 && MM_CLASS(size) <= MM_SMALL_MAX/8)
+		trace->hist[MM_CLASS(size)]++;
+	    break;
+	case 'f':
+	    if (1 != fscanf(tracefile, "%d", &index)) {
+		err = "bad free request";
+		goto out;
+	    }
+	    trace->ops[op_index].type = MMB_FREE;
+	    break;
+	default:
+	    err = "bogus type character";
+	    goto out;
+	}
+	if (index < 0 || index >= trace->num_ids) {
+	    err = "id out of range";
+	    goto out;
+	}
+	trace->ops[op_index].index = index;
+	op_index++;
+    }
+    if (max_index != trace->num_ids - 1 || trace->num_ops != op_index)
+	err = "counts do not match the header";
+
+ out:
+    fclose(tracefile);
+    if (err != NULL) {
+	printf("Tracefile %s: %s\n", path, err);
+	mmb_free_trace(trace);
+	return NULL;
+    }
+    return trace;
+}
+
+/*
+ * mmb_free_trace - Free the trace record and the three arrays it points
+ *                  to, all of which were allocated in mmb_read_trace().
+ */
+void mmb_free_trace(mmb_trace_t *trace)
+{
+    free(trace->ops);         /* free the three arrays... */
+    free(trace->blocks);
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of an allocator.
+ **********************************************************************/
+
+/*
+ * start - Reset the heap (memlib) to its limit in opts and start the
+ *     allocator on it
+ */
+static int start(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		 const mmb_opts_t *opts)
+{
+    if (alloc->memlib) {
+	mem_reset_brk();
+	mem_set_max(opts != NULL ? opts->heap_max : 0);
+    }
+    if (opts != NULL && opts->hint && alloc->init_hint != NULL)
+	return alloc->init_hint(trace->sugg_heapsize, trace->hist);
+    return alloc->init != NULL ? alloc->init() : 0;
+}
+
+/*
+ * mmb_valid - Check the allocator for correctness
+ */
+int mmb_valid(const mmb_alloc_t *alloc, mmb_trace_t *trace, int tracenum)
+{
+    range_t *ranges = NULL;
+    int valid;
+
+    valid = eval_valid(alloc, trace, tracenum, &ranges);
+    clear_ranges(&ranges);
+    return valid;
+}
+
+static int eval_valid(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		      int tracenum, range_t **ranges)
+{
+    int i, j;
+    int index;
+    int size;
+    int oldsize;
+    char *newp;
+    char *oldp;
+    char *p;
+
+    /* Call the package's init function */
+    if (start(alloc, trace, NULL) < 0) {
+	malloc_error(tracenum, 0, "init failed.");
+	return 0;
+    }
+
+    /* Interpret each operation in the trace in order */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case MMB_ALLOC: /* malloc */
+
+	    /* Call the package's malloc */
+	    if ((p = (char*) alloc->malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "malloc failed.");
+		return 0;
+	    }
+
+	    /*
+	     * Test the range of the new block for correctness and add it
+	     * to the range list if OK. The block must be  be aligned properly,
+	     * and must not overlap any currently allocated block.
+	     */
+	    if (add_range(ranges, p, size, alloc, tracenum, i) == 0)
+		return 0;
+
+	    /* ADDED: cgw
+	     * fill range with low byte of index.  This will be used later
+	     * if we realloc the block and wish to make sure that the old
+	     * data was copied to the new block
+	     */
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case MMB_REALLOC: /* realloc */
+
+	    /* Call the package's realloc */
+	    oldp = trace->blocks[index];
+	    if ((newp = (char *) alloc->realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "realloc failed.");
+		return 0;
+	    }
+
+	    /* Remove the old region from the range list */
+	    remove_range(ranges, oldp);
+
+	    /* Check new block for correctness and add it to range list */
+	    if (add_range(ranges, newp, size, alloc, tracenum, i) == 0)
+		return 0;
+
+	    /* ADDED: cgw
+	     * Make sure that the new block contains the data from the old
+	     * block and then fill in the new block with the low order byte
+	     * of the new index
+	     */
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+	      if (newp[j] != (index & 0xFF)) {
+		malloc_error(tracenum, i, "realloc did not preserve the "
+			     "data from old block");
+		return 0;
+	      }
+	    }
+	    memset(newp, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case MMB_FREE: /* free */
+
+	    /* Remove region from list and call the package's free function */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    alloc->free(p);
+	    break;
+        }
+
+    }
+
+    /* As far as we know, this is a valid malloc package */
+    return 1;
+}
+
+/*
+ * mmb_util - Evaluate the space utilization of a memlib package
+ *   The idea is to remember the high water mark "hwm" of the heap for
+ *   an optimal allocator, i.e., no gaps and no internal fragmentation.
+ *   Utilization is the ratio hwm/heapsize, where heapsize is the
+ *   size of the heap in bytes after running the package on the trace.
+ *   Since mem_sbrk() lets the package shrink the heap again, we use
+ *   the high water mark of brk rather than its final value, plus
+ *   whatever the package maps outside the heap (off_heap_bytes). With
+ *   opts->nops only that many requests from the start are replayed,
+ *   and the heap is left as they leave it.
+ */
+double mmb_util(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		const mmb_opts_t *opts)
+{
+    int i, n;
+    int index;
+    int size, newsize, oldsize;
+    int max_total_size = 0;
+    int total_size = 0;
+    size_t heap_size;
+    char *p;
+    char *newp, *oldp;
+
+    if (!alloc->memlib)
+	return 0;
+
+    /* initialize the heap and the package */
+    if (start(alloc, trace, opts) < 0)
+	return -1;
+
+    n = opts != NULL && opts->nops > 0 && opts->nops < trace->num_ops ?
+	opts->nops : trace->num_ops;
+    for (i = 0;  i < n;  i++) {
+        switch (trace->ops[i].type) {
+
+        case MMB_ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = (char *) alloc->malloc(size)) == NULL)
+		return -1;
+
+	    /* Remember region and size */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    total_size += size;
+
+	    /* Update statistics */
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case MMB_REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldsize = trace->block_sizes[index];
+
+	    oldp = trace->blocks[index];
+	    if ((newp = (char *) alloc->realloc(oldp,newsize)) == NULL)
+		return -1;
+
+	    /* Remember region and size */
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = newsize;
+
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    total_size += (newsize - oldsize);
+
+	    /* Update statistics */
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case MMB_FREE: /* free */
+	    index = trace->ops[i].index;
+	    size = trace->block_sizes[index];
+	    p = trace->blocks[index];
+
+	    alloc->free(p);
+
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    total_size -= size;
+
+	    break;
+        }
+    }
+
+    heap_size = mem_peak_heapsize();
+    if (alloc->off_heap_bytes != NULL)
+	heap_size += alloc->off_heap_bytes();
+    return ((double)max_total_size / (double)heap_size);
+}
+
+/*
+ * mmb_peak_op - Index of the request after which the trace has the
+ *     most payload live (the first such request)
+ */
+int mmb_peak_op(mmb_trace_t *trace)
+{
+    int i, peak = 0;
+    long total = 0, max_total = -1;
+    mmb_op_t *op;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->ops[i];
+	if (op->type != MMB_ALLOC)
+	    total -= trace->block_sizes[op->index];
+	if (op->type != MMB_FREE) {
+	    total += op->size;
+	    trace->block_sizes[op->index] = op->size;
+	}
+	if (total > max_total) {
+	    max_total = total;
+	    peak = i;
+	}
+    }
+    return peak;
+}
+
+
+/*
+ * eval_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the package. Once a request has
+ *    failed, the remaining calls do nothing. With params->split the
+ *    two parts of the replay are also timed on their own.
+ */
+static void eval_speed(void *ptr)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    speed_t *params = (speed_t *)ptr;
+    const mmb_alloc_t *alloc = params->alloc;
+    mmb_trace_t *trace = params->trace;
+    double t[3];
+
+    /* Reset the heap and initialize the package */
+    if (params->split)
+	t[0] = now();
+    if (params->failed || start(alloc, trace, params->opts) < 0) {
+	params->failed = 1;
+	return;
+    }
+
+    /* Interpret each trace request */
+    for (i = 0;  i < params->nops;  i++) {
+	if (params->split && i == params->split)
+	    t[1] = now();
+        switch (trace->ops[i].type) {
+
+        case MMB_ALLOC: /* malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = (char *) alloc->malloc(size)) == NULL) {
+		params->failed = 1;
+		return;
+	    }
+            trace->blocks[index] = p;
+            break;
+
+	case MMB_REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+            if ((newp = (char *) alloc->realloc(oldp,newsize)) == NULL) {
+		params->failed = 1;
+		return;
+	    }
+            trace->blocks[index] = newp;
+            break;
+
+        case MMB_FREE: /* free */
+            index = trace->ops[i].index;
+            block = trace->blocks[index];
+            alloc->free(block);
+            break;
+        }
+    }
+
+    if (params->split) {
+	t[2] = now();
+	if (params->split == params->nops)
+	    t[1] = t[2];
+	if (t[1] - t[0] < params->part[0])
+	    params->part[0] = t[1] - t[0];
+	if (t[2] - t[1] < params->part[1])
+	    params->part[1] = t[2] - t[1];
+    }
+}
+
+/*
+ * now - Wall-clock time in seconds, as ftimer_gettod measures it
+ */
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * mmb_secs - Time replays of the trace (or its first opts->nops
+ *     requests) with fsecs; -1 if a request fails
+ */
+double mmb_secs(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		const mmb_opts_t *opts)
+{
+    speed_t params;
+    double secs;
+
+    if (!timer_ready) {
+	init_fsecs();
+	timer_ready = 1;
+    }
+    params.alloc = alloc;
+    params.trace = trace;
+    params.nops = opts != NULL && opts->nops > 0 && opts->nops < trace->num_ops ?
+	opts->nops : trace->num_ops;
+    params.opts = opts;
+    params.failed = 0;
+    params.split = 0;
+    secs = fsecs(eval_speed, &params);
+    return params.failed ? -1 : secs;
+}
+
+/*
+ * mmb_split_secs - Time replays of the trace with fsecs, and within the
+ *     same replays the requests before split and from it on; -1 if a
+ *     request fails
+ */
+int mmb_split_secs(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		   const mmb_opts_t *opts, int split, double secs[2])
+{
+    speed_t params;
+
+    if (!timer_ready) {
+	init_fsecs();
+	timer_ready = 1;
+    }
+    params.alloc = alloc;
+    params.trace = trace;
+    params.nops = opts != NULL && opts->nops > 0 && opts->nops < trace->num_ops ?
+	opts->nops : trace->num_ops;
+    params.opts = opts;
+    params.failed = 0;
+    params.split = split < 1 ? 1 : split > params.nops ? params.nops : split;
+    params.part[0] = params.part[1] = DBL_MAX;
+    fsecs(eval_speed, &params);
+    secs[0] = params.part[0];
+    secs[1] = params.part[1];
+    return params.failed ? -1 : 0;
+}
+
+/*
+ * mmb_min_heap - Binary search for the smallest memlib heap limit, in
+ *     pages, on which the allocator gets through the trace. Assumes an
+ *     allocator that fits under one limit fits under any larger one,
+ *     which a placement policy can violate by a few pages
+ */
+size_t mmb_min_heap(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		    const mmb_opts_t *opts)
+{
+    mmb_opts_t o;
+    size_t page = mem_pagesize();
+    size_t lo = 0, hi = MAX_HEAP / page;   /* in pages: lo fails, hi fits */
+    size_t mid;
+
+    if (!alloc->memlib)
+	return 0;
+    if (opts != NULL)
+	o = *opts;
+    else
+	memset(&o, 0, sizeof(o));
+    o.heap_max = 0;
+    if (mmb_util(alloc, trace, &o) < 0)
+	return 0;
+
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	o.heap_max = mid * page;
+	if (mmb_util(alloc, trace, &o) < 0)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return hi * page;
+}
+
+/*
+ * mmb_run - Check, measure and time the allocator on one trace
+ */
+int mmb_run(const mmb_alloc_t *alloc, mmb_trace_t *trace, int tracenum,
+	    const mmb_opts_t *opts, mmb_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->ops = trace->num_ops;
+    if (mmb_verbose > 1)
+	printf("Checking %s for correctness, ", alloc->name);
+    if ((stats->valid = mmb_valid(alloc, trace, tracenum))) {
+	if (mmb_verbose > 1)
+	    printf("efficiency, ");
+	if ((stats->util = mmb_util(alloc, trace, opts)) < 0) {
+	    printf("ERROR [trace %d]: %s failed in the utilization replay\n",
+		   tracenum, alloc->name);
+	    stats->util = 0;
+	    stats->valid = 0;
+	    return 0;
+	}
+	if (mmb_verbose > 1)
+	    printf("and performance.\n");
+	if ((stats->secs = mmb_secs(alloc, trace, opts)) < 0) {
+	    printf("ERROR [trace %d]: %s failed in a timed replay\n",
+		   tracenum, alloc->name);
+	    stats->valid = 0;
+	}
+    }
+    return stats->valid;
+}
+
+/*
+ * malloc_error - Report an error returned by the package
+ */
+static void malloc_error(int tracenum, int opnum, const char *msg)
+{
+    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+}
+
@@ -0,0 +1,119 @@
+/*
+ * mmbench.h - Trace replay library behind mdriver
+ *
+ * Loads trace files and replays them against an allocator given as a
+ * table of functions, checking every payload, measuring the space
+ * utilization and timing the replay, and hands the results back in a
+ * struct. mdriver is one front end; other benchmarks and fuzzers can
+ * link libmmbench.a and drive the same machinery directly.
+ */
+#ifndef MMBENCH_H
+#define MMBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm.h"
+
+/* Characterizes a single trace operation (allocator request) */
+typedef enum {MMB_ALLOC, MMB_FREE, MMB_REALLOC} mmb_reqtype_t;
+typedef struct {
+    mmb_reqtype_t type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} mmb_op_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (init_hint, opts.hint) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    mmb_op_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    uint32_t hist[MM_SMALL_MAX/8 + 1]; /* allocs per small class (opts.hint) */
+} mmb_trace_t;
+
+/*
+ * The allocator a replay drives. init (if not NULL) starts it on an
+ * empty heap before each replay, or init_hint does when the options ask
+ * for it. With memlib set the heap is the one in memlib.c: its break is
+ * reset first, payloads must lie inside it, and util can be measured.
+ * off_heap (if not NULL) names payloads the allocator deliberately keeps
+ * outside that heap, and off_heap_bytes (if not NULL) gives the bytes it
+ * has mapped for them, which util counts as heap.
+ */
+typedef struct {
+    const char *name;
+    int (*init)(void);
+    int (*init_hint)(size_t bytes, const uint32_t *hist);
+    void *(*malloc)(uint32_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, uint32_t size);
+    int memlib;
+    int (*off_heap)(void *ptr);
+    size_t (*off_heap_bytes)(void);
+} mmb_alloc_t;
+
+/* How a trace is replayed */
+typedef struct {
+    int nops;        /* requests to replay from the start (0 = all) */
+    int hint;        /* start with init_hint and the trace's hints */
+    size_t heap_max; /* memlib heap limit in bytes (0 = MAX_HEAP) */
+} mmb_opts_t;
+
+/* Summarizes the important stats for some allocator on some trace */
+typedef struct {
+    double ops;      /* number of ops (malloc/free/realloc) in the trace */
+    int valid;       /* was the trace processed correctly by the allocator? */
+    double secs;     /* number of secs needed to run the trace */
+    double util;     /* space utilization for this trace (0 without memlib) */
+
+    /* Note: secs and util are only defined if valid is true */
+} mmb_stats_t;
+
+/* The C library's malloc package, without memlib */
+extern const mmb_alloc_t mmb_libc;
+
+/* Print progress at 2, and timer details from 1 (shared with fsecs.c) */
+extern int mmb_verbose;
+
+/* Load a trace (NULL if it cannot be read) and free it again */
+extern mmb_trace_t *mmb_read_trace(const char *tracedir, const char *filename);
+extern void mmb_free_trace(mmb_trace_t *trace);
+
+/* Replay a trace checking every request: 1 if the allocator got it
+   right; otherwise the first problem is printed and 0 returned */
+extern int mmb_valid(const mmb_alloc_t *alloc, mmb_trace_t *trace, int tracenum);
+
+/* Peak payload over peak heap size for one replay, or -1 on failure
+   (opts may be NULL here and below) */
+extern double mmb_util(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		       const mmb_opts_t *opts);
+
+/* Index of the request at which the most payload is live */
+extern int mmb_peak_op(mmb_trace_t *trace);
+
+/* Seconds per replay, or -1 if a request failed (with a heap limit,
+   say); the trace should have passed mmb_valid first */
+extern double mmb_secs(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+		       const mmb_opts_t *opts);
+
+/* The same replays, timed in two parts: secs[0] is the start of the
+   package and the requests before request split, secs[1] the rest.
+   Each is the fastest seen over the replays; returns 0, or -1 as
+   mmb_secs would */
+extern int mmb_split_secs(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+			  const mmb_opts_t *opts, int split, double secs[2]);
+
+/* Smallest memlib heap limit (a page multiple) on which the trace
+   completes, or 0 if it does not even at MAX_HEAP */
+extern size_t mmb_min_heap(const mmb_alloc_t *alloc, mmb_trace_t *trace,
+			   const mmb_opts_t *opts);
+
+/* All three, the way mdriver scores a trace; returns stats->valid */
+extern int mmb_run(const mmb_alloc_t *alloc, mmb_trace_t *trace, int tracenum,
+		   const mmb_opts_t *opts, mmb_stats_t *stats);
+
+#endif /* MMBENCH_H */
@@ -0,0 +1,297 @@
+/*
+ * mmcheck.c - Regression checks for mm.c
+ *
+ * Each check drives mm.c through a case that has gone wrong before and
+ * says whether it still does. Every check runs in a child process of
+ * its own, on a fresh heap, so one that crashes is reported as failed
+ * and the rest still run. "make check" builds and runs them all.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define POOL_PAGES 33    /* pages in mm.c's guarded pool (2*GUARD_SLOTS + 1) */
+#define FILL_MAX   20000 /* most mappings made to push the pool below the heap */
+#define RETIRES    256   /* retires that move the epoch well past a block */
+#define REMAP_SPLITS 64  /* most ranges mm.c's move_payload leaves split */
+#define MOVES      400   /* reallocs that each move a payload by mremap */
+#define MOVE_BYTES 100000
+
+typedef struct {
+    const char *name;
+    int (*fn)(void);     /* 0 if the check passes */
+} check_t;
+
+static int check_retire_guarded(void);
+static int check_remap_maps(void);
+static int check_segv_chain(void);
+static int check_segv_kept(void);
+static int check_free_class(void);
+static int check_retire_untouched(void);
+
+static check_t checks[] = {
+    {"mm_retire of a guarded block", check_retire_guarded},
+    {"mappings left by remapping reallocs", check_remap_maps},
+    {"SIGSEGV outside the guarded pool", check_segv_chain},
+    {"SIGSEGV handler installed after the pool", check_segv_kept},
+    {"mm_free_class given the wrong class", check_free_class},
+    {"retired blocks untouched in a section", check_retire_untouched},
+    {NULL, NULL}
+};
+
+static int aborts(void (*fn)(void *), void *arg);
+static int nmaps(void);
+static void on_segv(int sig);
+static void *retire_and_exit(void *bp);
+
+static sigjmp_buf segv_env;
+
+int main(void)
+{
+    int i, status, failed = 0;
+    pid_t pid;
+
+    for (i = 0; checks[i].name != NULL; i++) {
+	fflush(stdout);
+	if ((pid = fork()) == 0) {
+	    mem_init();
+	    _exit(checks[i].fn() == 0 ? 0 : 1);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+	    perror("mmcheck");
+	    exit(1);
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	    printf("%-40s ok\n", checks[i].name);
+	else {
+	    failed++;
+	    if (WIFSIGNALED(status))
+		printf("%-40s FAILED (%s)\n", checks[i].name,
+		       strsignal(WTERMSIG(status)));
+	    else
+		printf("%-40s FAILED\n", checks[i].name);
+	}
+    }
+    exit(failed ? 1 : 0);
+}
+
+/*
+ * aborts - Does fn(arg) abort? Run in a child with stderr silenced
+ */
+static int aborts(void (*fn)(void *), void *arg)
+{
+    int status, fd;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+	if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+	    dup2(fd, 2);
+	fn(arg);
+	_exit(0);
+    }
+    return pid > 0 && waitpid(pid, &status, 0) == pid &&
+	WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+/*
+ * nmaps - Number of mappings in the process, or -1
+ */
+static int nmaps(void)
+{
+    FILE *fp;
+    int c, n = 0;
+
+    if ((fp = fopen("/proc/self/maps", "r")) == NULL)
+	return -1;
+    while ((c = getc(fp)) != EOF)
+	if (c == '\n')
+	    n++;
+    fclose(fp);
+    return n;
+}
+
+/*
+ * on_segv - The program's own SIGSEGV handler
+ */
+static void on_segv(int sig)
+{
+    siglongjmp(segv_env, 1);
+}
+
+/*
+ * check_retire_guarded - A sampled block passed to mm_retire is freed
+ *     once the epoch has moved on, even with the guarded pool mapped
+ *     below the heap, where an offset from the heap cannot reach it
+ */
+static int check_retire_guarded(void)
+{
+    size_t bytes = POOL_PAGES * mem_pagesize();
+    char *p, *x;
+    int i;
+
+    mm_init();
+
+    /* Fill the holes above the heap; the pool then goes in the first
+       one below it, which is let go again */
+    for (i = 0; i < FILL_MAX; i++) {
+	x = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (x == MAP_FAILED)
+	    break;
+	if (x < (char *)mem_heap_lo()) {
+	    munmap(x, bytes);
+	    break;
+	}
+    }
+
+    mm_set_guard_rate(1);
+    p = mm_malloc(24);
+    mm_set_guard_rate(0);
+    if (p == NULL || !mm_is_guarded(p))
+	return 1;
+
+    mm_retire(p);
+    for (i = 0; i < RETIRES; i++)
+	mm_retire(mm_malloc(32));
+
+    /* Reclaimed, so freeing it now is a double free */
+    return !aborts(mm_free, p);
+}
+
+/*
+ * check_remap_maps - Payloads moved by mremap split the heap's mapping
+ *     at most REMAP_SPLITS times over, and freeing them joins it again
+ */
+static int check_remap_maps(void)
+{
+    static char *moved[MOVES];
+    int i, start, most;
+
+    mm_init();
+    start = nmaps();
+    for (i = 0; i < MOVES; i++) {
+	moved[i] = mm_malloc(MOVE_BYTES);
+	mm_malloc(16);  /* keeps the realloc from growing in place */
+	memset(moved[i], i, MOVE_BYTES);
+	moved[i] = mm_realloc(moved[i], 2 * MOVE_BYTES);
+	if (moved[i] == NULL || moved[i][MOVE_BYTES - 1] != (char)i)
+	    return 1;
+    }
+    most = nmaps();
+    for (i = 0; i < MOVES; i++)
+	mm_free(moved[i]);
+    return start < 0 || most > start + 2 * REMAP_SPLITS ||
+	nmaps() > start + 2;
+}
+
+/*
+ * check_segv_chain - A fault outside the guarded pool goes to the
+ *     handler that was installed before the pool was mapped
+ */
+static int check_segv_chain(void)
+{
+    volatile char *x;
+
+    mm_init();
+    signal(SIGSEGV, on_segv);
+    mm_set_guard_rate(1);
+    mm_free(mm_malloc(24));
+    mm_set_guard_rate(0);
+
+    x = mmap(NULL, mem_pagesize(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+	     -1, 0);
+    if (x == MAP_FAILED)
+	return 1;
+    if (sigsetjmp(segv_env, 1) == 0) {
+	*x = 1;
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * check_segv_kept - Starting a new heap takes down the guarded pool, but
+ *     leaves alone a SIGSEGV handler installed since it was mapped
+ */
+static int check_segv_kept(void)
+{
+    struct sigaction sa;
+
+    mm_init();
+    mm_set_guard_rate(1);
+    mm_free(mm_malloc(24));
+    mm_set_guard_rate(0);
+
+    signal(SIGSEGV, on_segv);
+    mm_init();
+    sigaction(SIGSEGV, NULL, &sa);
+    return sa.sa_handler != on_segv;
+}
+
+/*
+ * check_free_class - A small block freed as a larger class does not come
+ *     back for a request of that class
+ */
+static int check_free_class(void)
+{
+    char *p, *q;
+
+    mm_init();
+    p = mm_malloc_class(2);
+    mm_malloc_class(2);  /* a live neighbour, so p is cached when freed */
+    mm_free_class(p, 8);
+    q = mm_malloc_class(8);
+    return q == NULL || mm_malloc_usable_size(q) < 8 * 8 - 8;
+}
+
+/*
+ * retire_and_exit - Thread body: retire bp, then exit, which leaves the
+ *     block to the other threads
+ */
+static void *retire_and_exit(void *bp)
+{
+    mm_retire(bp);
+    return NULL;
+}
+
+/*
+ * check_retire_untouched - A block retired while a section is open is
+ *     not written until it is freed, by this thread or after the thread
+ *     that retired it has exited
+ */
+static int check_retire_untouched(void)
+{
+    char *p, *q, expect[64];
+    pthread_t tid;
+    int i;
+
+    mm_init();
+    memset(expect, 0x5a, sizeof(expect));
+    p = mm_malloc(sizeof(expect));
+    q = mm_malloc(sizeof(expect));
+    memcpy(p, expect, sizeof(expect));
+    memcpy(q, expect, sizeof(expect));
+
+    mm_epoch_enter();
+    mm_retire(p);
+    if (pthread_create(&tid, NULL, retire_and_exit, q) != 0 ||
+	pthread_join(tid, NULL) != 0)
+	return 1;
+    for (i = 0; i < RETIRES; i++)
+	mm_retire(mm_malloc(sizeof(expect)));
+    if (memcmp(p, expect, sizeof(expect)) != 0 ||
+	memcmp(q, expect, sizeof(expect)) != 0)
+	return 1;
+    mm_epoch_exit();
+    return 0;
+}
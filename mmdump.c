@@ -0,0 +1,249 @@
+/*
+ * mmdump.c - Offline analyzer for mm_dump heap snapshots
+ *
+ * Reads the block map mm_dump wrote (see mm.h) and reports where the
+ * heap's bytes are, the sizes of the free blocks, how fragmented the
+ * free space is, how small the heap could get if the live blocks were
+ * packed together, and the largest request the heap could serve as it
+ * stands. Nothing here needs the process the snapshot came from.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "mm.h"
+
+#define OVERHEAD  8       /* header and footer of a heap block (bytes) */
+#define NBUCKETS 33       /* free-size histogram: one bucket per power of two */
+
+static const char *state_names[MM_DUMP_NSTATES] = {
+    "allocated", "free", "cached", "deferred",
+    "run", "run free", "dead"
+};
+
+static const char *region_names[MM_REGION_NKINDS] = {
+    "heap", "sealed", "run"
+};
+
+static void report(mm_dump_hdr_t *hdr, mm_dump_region_t *regions,
+		   mm_dump_block_t *blocks);
+static void print_blocks(mm_dump_hdr_t *hdr, mm_dump_block_t *blocks);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    mm_dump_hdr_t hdr;
+    mm_dump_region_t *regions;
+    mm_dump_block_t *blocks;
+    int c, list = 0;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "lh")) != EOF) {
+	switch (c) {
+	case 'l': /* List every block */
+	    list = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	hdr.magic != MM_DUMP_MAGIC || hdr.version != MM_DUMP_VERSION) {
+	fprintf(stderr, "mmdump: %s is not an mm_dump snapshot\n", argv[optind]);
+	exit(1);
+    }
+    regions = malloc(hdr.nregions * sizeof(mm_dump_region_t) + 1);
+    blocks = malloc(hdr.nblocks * sizeof(mm_dump_block_t) + 1);
+    if (regions == NULL || blocks == NULL ||
+	fread(regions, sizeof(mm_dump_region_t), hdr.nregions, fp) != hdr.nregions ||
+	fread(blocks, sizeof(mm_dump_block_t), hdr.nblocks, fp) != hdr.nblocks) {
+	fprintf(stderr, "mmdump: %s is truncated\n", argv[optind]);
+	exit(1);
+    }
+    fclose(fp);
+
+    if (list)
+	print_blocks(&hdr, blocks);
+    else
+	report(&hdr, regions, blocks);
+    free(regions);
+    free(blocks);
+    exit(0);
+}
+
+/*
+ * report - Print the analysis of one snapshot
+ */
+static void report(mm_dump_hdr_t *hdr, mm_dump_region_t *regions,
+		   mm_dump_block_t *blocks)
+{
+    unsigned long count[MM_DUMP_NSTATES] = {0};
+    unsigned long bytes[MM_DUMP_NSTATES] = {0};
+    unsigned long fcount[NBUCKETS] = {0};
+    unsigned long fbytes[NBUCKETS] = {0};
+    unsigned long region_bytes[MM_REGION_NKINDS] = {0};
+    unsigned long free_bytes = 0, small_free = 0, purged = 0;
+    unsigned long live = 0, idle = 0;
+    unsigned long fixed = hdr->heap_size;  /* prologue, epilogue and padding */
+    unsigned long largest = 0, span = 0, merged = 0, room, grow;
+    mm_dump_block_t *b, *last = NULL;
+    uint32_t i;
+    int k;
+
+    for (i = 0; i < hdr->nblocks; i++) {
+	b = &blocks[i];
+	if (b->state >= MM_DUMP_NSTATES)
+	    continue;
+	count[b->state]++;
+	bytes[b->state] += b->size;
+
+	/* Carved blocks lie inside their run's heap block */
+	if (b->flags & MM_DUMP_CARVED)
+	    continue;
+	last = b;
+	fixed -= b->size;
+
+	/* Free, cached and deferred neighbours are what the heap
+	   coalesces into once it is pressed for memory */
+	if (b->state == MM_DUMP_FREE || b->state == MM_DUMP_CACHED ||
+	    b->state == MM_DUMP_DEFERRED) {
+	    span += b->size;
+	    if (span > merged)
+		merged = span;
+	} else {
+	    span = 0;
+	    live += b->size;
+	}
+	if (b->state != MM_DUMP_FREE) {
+	    if (b->state == MM_DUMP_CACHED || b->state == MM_DUMP_DEFERRED)
+		idle += b->size;
+	    continue;
+	}
+
+	/* Free blocks on the free list, by power-of-two size */
+	for (k = 0; k < NBUCKETS - 1 && (2UL << k) <= b->size; k++)
+	    ;
+	fcount[k]++;
+	fbytes[k] += b->size;
+	free_bytes += b->size;
+	if (b->size > largest)
+	    largest = b->size;
+	if (b->size <= MM_SMALL_MAX)
+	    small_free += b->size;
+	if (b->flags & MM_DUMP_PURGED)
+	    purged += b->size;
+    }
+    for (i = 0; i < hdr->nregions; i++)
+	if (regions[i].kind < MM_REGION_NKINDS)
+	    region_bytes[regions[i].kind] += regions[i].size;
+
+    printf("Heap at 0x%llx: %llu bytes, %u blocks",
+	   (unsigned long long)hdr->heap_addr,
+	   (unsigned long long)hdr->heap_size, hdr->nblocks);
+    if (hdr->heap_limit)
+	printf(", budget %llu bytes", (unsigned long long)hdr->heap_limit);
+    printf("\n\n");
+
+    printf("%-12s%10s%14s%8s\n", "region", "count", "bytes", "%heap");
+    for (k = 0; k < MM_REGION_NKINDS; k++) {
+	unsigned long n = 0;
+
+	for (i = 0; i < hdr->nregions; i++)
+	    n += regions[i].kind == k;
+	if (n)
+	    printf("%-12s%10lu%14lu%7.1f%%\n", region_names[k], n,
+		   region_bytes[k], 100.0 * region_bytes[k] / hdr->heap_size);
+    }
+    printf("\n");
+
+    printf("%-12s%10s%14s%8s\n", "state", "blocks", "bytes", "%heap");
+    for (k = 0; k < MM_DUMP_NSTATES; k++)
+	if (count[k])
+	    printf("%-12s%10lu%14lu%7.1f%%\n", state_names[k], count[k],
+		   bytes[k], 100.0 * bytes[k] / hdr->heap_size);
+    printf("\n");
+
+    printf("%-22s%10s%14s\n", "free block size", "blocks", "bytes");
+    for (k = 0; k < NBUCKETS; k++)
+	if (fcount[k])
+	    printf("%10lu - %-10lu%10lu%14lu\n", 1UL << k,
+		   (2UL << k) - 1, fcount[k], fbytes[k]);
+    printf("\n");
+
+    printf("Fragmentation\n");
+    printf("  free share of the heap       %7.1f%%\n",
+	   100.0 * free_bytes / hdr->heap_size);
+    printf("  external (1 - largest/free)  %7.3f\n",
+	   free_bytes ? 1.0 - (double)largest / free_bytes : 0.0);
+    printf("  free bytes in small blocks   %7.1f%%   (<= %d bytes)\n",
+	   free_bytes ? 100.0 * small_free / free_bytes : 0.0, MM_SMALL_MAX);
+    printf("  free bytes purged            %7.1f%%\n",
+	   free_bytes ? 100.0 * purged / free_bytes : 0.0);
+    printf("  held in caches and queues    %7.1f%%   (%lu bytes)\n",
+	   100.0 * idle / hdr->heap_size, idle);
+    printf("\n");
+
+    printf("Compaction (live blocks packed at the bottom of the heap)\n");
+    printf("  heap now                     %14llu\n",
+	   (unsigned long long)hdr->heap_size);
+    printf("  packed                       %14lu   (%.1f%% smaller)\n",
+	   live + idle + fixed, 100.0 - 100.0 * (live + idle + fixed) / hdr->heap_size);
+    printf("  packed, caches released      %14lu   (%.1f%% smaller)\n",
+	   live + fixed, 100.0 - 100.0 * (live + fixed) / hdr->heap_size);
+    printf("\n");
+
+    /* A request grows the last block if it is free and nothing fits */
+    printf("Largest allocatable payload\n");
+    printf("  from a free block            %14lu\n",
+	   largest > OVERHEAD ? largest - OVERHEAD : 0);
+    printf("  once caches are released     %14lu\n",
+	   merged > OVERHEAD ? merged - OVERHEAD : 0);
+    if (hdr->heap_limit) {
+	room = hdr->heap_limit > hdr->heap_size ?
+	    hdr->heap_limit - hdr->heap_size : 0;
+	grow = room + (last != NULL && last->state == MM_DUMP_FREE ? last->size : 0);
+	printf("  growing to the budget        %14lu\n",
+	       grow > OVERHEAD ? grow - OVERHEAD : 0);
+    }
+}
+
+/*
+ * print_blocks - List every block of the snapshot in address order
+ */
+static void print_blocks(mm_dump_hdr_t *hdr, mm_dump_block_t *blocks)
+{
+    mm_dump_block_t *b;
+    uint32_t i;
+
+    printf("%12s%10s  %s\n", "offset", "size", "state");
+    for (i = 0; i < hdr->nblocks; i++) {
+	b = &blocks[i];
+	printf("%12u%10u  %s%s%s%s\n", b->offset, b->size,
+	       (b->flags & MM_DUMP_CARVED) ? "  " : "",
+	       b->state < MM_DUMP_NSTATES ? state_names[b->state] : "?",
+	       (b->flags & MM_DUMP_PURGED) ? ", purged" : "",
+	       (b->flags & MM_DUMP_SEALED) ? ", sealed" : "");
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmdump [-hl] <snapshot>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h  Print this message.\n");
+    fprintf(stderr, "\t-l  List every block instead of the analysis.\n");
+}
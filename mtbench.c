@@ -0,0 +1,262 @@
+/*
+ * mtbench.c - Multithreaded scalability benchmark for the mm package
+ *
+ * Each thread runs a random mix of small mm_malloc/mm_free requests
+ * against a private set of slots. The run is repeated for a range of
+ * thread counts with the small-class cache in each of its modes, so the
+ * lock-free stacks can be compared with the locked lists and with the
+ * plain heap. With -m the background maintenance thread runs alongside.
+ *
+ * With -c the workload is cache-scratch instead: the main thread
+ * allocates one small object per worker back to back, and each worker
+ * frees its object and then repeatedly allocates a small block, writes
+ * it many times and frees it. An allocator that hands the freed object
+ * (or its neighbours) back to the worker makes workers write to the
+ * same cache lines; MM_SMALL_RUNS should not.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Defaults, overridden on the command line */
+#define MAXTHREADS  64      /* largest thread count tried */
+#define OPS     200000      /* malloc+free requests per thread */
+#define SLOTS      256      /* live blocks each thread can hold */
+#define MAXSIZE    120      /* largest request size (bytes) */
+#define REFILL      16      /* blocks carved per small-class miss */
+#define SCRATCH      8      /* object size for the cache-scratch workload */
+#define WRITES     100      /* writes per object in cache-scratch */
+
+/* Per-thread arguments */
+typedef struct {
+    int ops;                /* number of requests to issue */
+    unsigned int seed;      /* rand_r state */
+    char *obj;              /* object handed over by main (cache-scratch) */
+} worker_t;
+
+static const struct {
+    int mode;
+    const char *name;
+} modes[] = {
+    { MM_SMALL_OFF,      "heap" },
+    { MM_SMALL_LOCKED,   "locked" },
+    { MM_SMALL_LOCKFREE, "lockfree" },
+    { MM_SMALL_RUNS,     "runs" },
+};
+
+/* Maintenance counters summed over all runs (-m) */
+static unsigned int maint_period = 0;
+static mm_maint_stats_t maint_total;
+
+/* Workload run by each thread (-c selects scratch) */
+static void *worker(void *arg);
+static void *scratch(void *arg);
+static void *(*workload)(void *) = worker;
+
+static double run(int mode, int nthreads, int ops, int refill);
+static double now(void);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    int c, i, n;
+    int maxthreads = MAXTHREADS;
+    int ops = OPS;
+    int refill = REFILL;
+
+    while ((c = getopt(argc, argv, "cm:n:o:r:h")) != EOF) {
+	switch (c) {
+	case 'c': /* Run the cache-scratch workload */
+	    workload = scratch;
+	    break;
+	case 'm': /* Run the maintenance thread with this period (ms) */
+	    maint_period = atoi(optarg);
+	    break;
+	case 'n': /* Largest thread count */
+	    maxthreads = atoi(optarg);
+	    break;
+	case 'o': /* Requests per thread */
+	    ops = atoi(optarg);
+	    break;
+	case 'r': /* Small-class refill batch */
+	    refill = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    mem_init();
+
+    printf("%8s", "threads");
+    for (i = 0; i < sizeof(modes)/sizeof(modes[0]); i++)
+	printf("%12s", modes[i].name);
+    printf("   (Mops/sec)\n");
+
+    for (n = 1; n <= maxthreads; n *= 2) {
+	printf("%8d", n);
+	for (i = 0; i < sizeof(modes)/sizeof(modes[0]); i++) {
+	    printf("%12.2f", run(modes[i].mode, n, ops, refill));
+	    fflush(stdout);
+	}
+	printf("\n");
+    }
+
+    if (maint_period) {
+	printf("maintenance: %lu passes, %lu deferred frees, "
+	       "%lu cached blocks flushed, %lu pages purged, %lu bytes trimmed\n",
+	       maint_total.passes, maint_total.deferred_frees,
+	       maint_total.cache_flushed, maint_total.pages_purged,
+	       maint_total.bytes_trimmed);
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run - Time nthreads workers on a fresh heap and return Mops/sec
+ */
+static double run(int mode, int nthreads, int ops, int refill)
+{
+    pthread_t *tids;
+    worker_t *args;
+    mm_maint_stats_t ms;
+    double start, secs;
+    int i;
+
+    if ((tids = malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(args = malloc(nthreads * sizeof(worker_t))) == NULL) {
+	fprintf(stderr, "mtbench: malloc failed\n");
+	exit(1);
+    }
+
+    mem_reset_brk();
+    mm_set_small_mode(mode, refill);
+    if (mm_init() < 0) {
+	fprintf(stderr, "mtbench: mm_init failed\n");
+	exit(1);
+    }
+
+    if (maint_period && mm_maint_start(maint_period) < 0) {
+	fprintf(stderr, "mtbench: mm_maint_start failed\n");
+	exit(1);
+    }
+
+    /* Hand-over objects for cache-scratch, allocated back to back */
+    for (i = 0; i < nthreads && workload == scratch; i++)
+	if ((args[i].obj = mm_malloc(SCRATCH)) == NULL) {
+	    fprintf(stderr, "mtbench: mm_malloc failed\n");
+	    exit(1);
+	}
+
+    start = now();
+    for (i = 0; i < nthreads; i++) {
+	args[i].ops = ops;
+	args[i].seed = i + 1;
+	pthread_create(&tids[i], NULL, workload, &args[i]);
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    secs = now() - start;
+
+    if (maint_period) {
+	mm_maint_stop();
+	mm_maint_stats(&ms);
+	maint_total.passes += ms.passes;
+	maint_total.deferred_frees += ms.deferred_frees;
+	maint_total.cache_flushed += ms.cache_flushed;
+	maint_total.pages_purged += ms.pages_purged;
+	maint_total.bytes_trimmed += ms.bytes_trimmed;
+    }
+
+    free(tids);
+    free(args);
+    return ((double)nthreads * ops / 1e6) / secs;
+}
+
+/*
+ * worker - Randomly allocate into empty slots and free full ones
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    char *slots[SLOTS];
+    int i, k;
+
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < w->ops; i++) {
+	k = rand_r(&w->seed) % SLOTS;
+	if (slots[k] == NULL) {
+	    if ((slots[k] = mm_malloc(1 + rand_r(&w->seed) % MAXSIZE)) == NULL) {
+		fprintf(stderr, "mtbench: mm_malloc failed\n");
+		exit(1);
+	    }
+	    slots[k][0] = (char)k;   /* touch the block */
+	}
+	else {
+	    mm_free(slots[k]);
+	    slots[k] = NULL;
+	}
+    }
+    for (k = 0; k < SLOTS; k++)
+	if (slots[k] != NULL)
+	    mm_free(slots[k]);
+    return NULL;
+}
+
+/*
+ * scratch - Free the handed-over object, then allocate, write and free
+ *     a small block ops times
+ */
+static void *scratch(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    volatile char *p;
+    int i, j;
+
+    mm_free(w->obj);
+    for (i = 0; i < w->ops; i++) {
+	if ((p = mm_malloc(SCRATCH)) == NULL) {
+	    fprintf(stderr, "mtbench: mm_malloc failed\n");
+	    exit(1);
+	}
+	for (j = 0; j < WRITES; j++)
+	    p[j % SCRATCH]++;
+	mm_free((void *)p);
+    }
+    return NULL;
+}
+
+/*
+ * now - Wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-ch] [-m <ms>] [-n <threads>] [-o <ops>] [-r <refill>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c            Run the cache-scratch workload.\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-m <ms>       Run the maintenance thread every <ms> milliseconds.\n");
+    fprintf(stderr, "\t-n <threads>  Largest thread count (default %d).\n", MAXTHREADS);
+    fprintf(stderr, "\t-o <ops>      Requests per thread (default %d).\n", OPS);
+    fprintf(stderr, "\t-r <refill>   Small-class refill batch (default %d).\n", REFILL);
+}
@@ -0,0 +1,466 @@
+/*
+ * packbound.c - Offline packing bounds on the heap each trace needs
+ *
+ * mdriver's util divides the peak live payload by the peak heap size,
+ * and no allocator reaches 100% on it: payloads are 8-byte aligned, and
+ * blocks that are live at different times still have to fit around each
+ * other. This tool knows every lifetime in advance and asks how small
+ * the heap could be:
+ *
+ *   live    the aligned live bytes at the busiest request, which every
+ *           allocator needs. This is only the trivial live-load bound:
+ *           it ignores that blocks live at different times can force
+ *           gaps. When a packing below meets it, or the exact search
+ *           finishes, it is the optimum itself (marked *)
+ *   packed  the best of several offline packings (lowest-fit in order of
+ *           arrival, size, lifetime and area), a heap an allocator that
+ *           knew the future could get by with
+ *
+ * Where packed is above live and no * is shown, the optimum lies
+ * somewhere between the two and this tool does not narrow it down.
+ *
+ * Each block is a rectangle: its aligned size by the requests it lives
+ * across. A realloc ends one rectangle and starts the next at the same
+ * request, so in-place and moving reallocs are both allowed for. On
+ * traces with at most -n blocks an exact branch-and-bound search over
+ * lowest-fit orders finds the optimum (every optimal packing is a
+ * lowest-fit packing in the order of its offsets). mm_malloc is then
+ * replayed on each trace, and its peak heap compared with all three.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "mmbench.h"
+#include "memlib.h"
+#include "config.h"
+
+#define EXACT_ITEMS 12         /* default -n: largest trace searched exactly */
+#define EXACT_WORK  200000000L /* exact search gives up at nodes x blocks */
+#define MAXLINE     1024       /* max tracedir length */
+
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+/* One block lifetime: live over requests [start, end) */
+typedef struct {
+    uint32_t req;    /* requested payload bytes */
+    uint32_t size;   /* the same, aligned */
+    int start;
+    int end;
+} item_t;
+
+/* A packing in progress */
+typedef struct {
+    item_t *items;
+    int nitems;
+    int *placed;           /* items placed so far, by offset */
+    int nplaced;
+    unsigned long *off;    /* offset of each placed item */
+    char *used;            /* exact search: item is placed */
+    unsigned long best;    /* exact search: lowest height found */
+    unsigned long lb;      /* exact search: stop once best reaches it */
+    long nodes;
+    long max_nodes;        /* exact search: give up after this many */
+} pack_t;
+
+static char *default_tracefiles[] = {
+    DEFAULT_TRACEFILES, NULL
+};
+
+static int make_items(mmb_trace_t *trace, item_t **itemsp);
+static unsigned long max_load(item_t *items, int n, int aligned);
+static unsigned long pack_order(pack_t *p, int *order);
+static unsigned long pack_heuristic(pack_t *p);
+static int pack_exact(pack_t *p, unsigned long ub, unsigned long lb);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    static const mmb_alloc_t mm_alloc = {
+	"mm_malloc", mm_init, mm_init_hint, mm_malloc, mm_free, mm_realloc, 1
+    };
+    mmb_opts_t opts = {0, 0, 0};
+    char tracedir[MAXLINE] = TRACEDIR;
+    char **tracefiles = default_tracefiles;
+    int c, i, n, exact_items = EXACT_ITEMS, ntraces = 0, exact;
+    unsigned long payload, lb, packed, heap;
+    double sum_util = 0, sum_live = 0, sum_packed = 0;
+    mmb_trace_t *trace;
+    item_t *items;
+    pack_t p;
+
+    while ((c = getopt(argc, argv, "t:n:k:Hh")) != EOF) {
+	switch (c) {
+	case 't': /* Directory of the default traces */
+	    snprintf(tracedir, sizeof(tracedir) - 1, "%s", optarg);
+	    if (tracedir[strlen(tracedir)-1] != '/')
+		strcat(tracedir, "/");
+	    break;
+	case 'n': /* Largest trace (in blocks) to search exactly */
+	    exact_items = atoi(optarg);
+	    break;
+	case 'k': /* mm_malloc placement, as in mdriver */
+	    mm_set_fit(atoi(optarg));
+	    break;
+	case 'H': /* Start mm_malloc with the trace's hints */
+	    opts.hint = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind < argc) {
+	tracefiles = &argv[optind];
+	tracedir[0] = '\0';
+    }
+
+    mem_init();
+    printf("%-20s%7s%10s%11s%10s%10s%8s%7s%7s\n", "trace", "blocks",
+	   "payload", "live", "packed", "mm heap", "util", "live", "packed");
+    for (i = 0; tracefiles[i] != NULL; i++) {
+	if ((trace = mmb_read_trace(tracedir, tracefiles[i])) == NULL)
+	    exit(1);
+	if ((n = make_items(trace, &items)) < 0) {
+	    fprintf(stderr, "packbound: %s frees or reallocs a block it never allocated\n",
+		    tracefiles[i]);
+	    exit(1);
+	}
+
+	p.items = items;
+	p.nitems = n;
+	p.placed = malloc(n * sizeof(int) + 1);
+	p.off = malloc(n * sizeof(unsigned long) + 1);
+	p.used = calloc(n + 1, 1);
+	if (p.placed == NULL || p.off == NULL || p.used == NULL) {
+	    fprintf(stderr, "packbound: out of memory\n");
+	    exit(1);
+	}
+
+	payload = max_load(items, n, 0);
+	lb = max_load(items, n, 1);
+	packed = pack_heuristic(&p);
+	exact = packed == lb;
+	if (!exact && n <= exact_items && pack_exact(&p, packed, lb)) {
+	    lb = p.best;
+	    exact = 1;
+	}
+
+	if (mmb_util(&mm_alloc, trace, &opts) < 0) {
+	    fprintf(stderr, "packbound: mm_malloc failed on %s\n", tracefiles[i]);
+	    exit(1);
+	}
+	heap = mem_peak_heapsize();
+
+	printf("%-20s%7d%10lu%10lu%c%10lu%10lu%7.1f%%%6.1f%%%6.1f%%\n",
+	       tracefiles[i], n, payload, lb, exact ? '*' : ' ', packed, heap,
+	       100.0 * payload / heap, 100.0 * lb / heap, 100.0 * packed / heap);
+	sum_util += (double)payload / heap;
+	sum_live += (double)lb / heap;
+	sum_packed += (double)packed / heap;
+	ntraces++;
+
+	free(p.placed);
+	free(p.off);
+	free(p.used);
+	free(items);
+	mmb_free_trace(trace);
+    }
+    if (ntraces > 1)
+	printf("%-68s%7.1f%%%6.1f%%%6.1f%%\n", "Mean", 100.0 * sum_util / ntraces,
+	       100.0 * sum_live / ntraces, 100.0 * sum_packed / ntraces);
+    printf("* live is the optimum\n");
+    exit(0);
+}
+
+/*
+ * make_items - Turn a trace into block lifetimes, sorted by start.
+ *     Returns how many, or -1 if the trace is malformed
+ */
+static int make_items(mmb_trace_t *trace, item_t **itemsp)
+{
+    item_t *items;
+    mmb_op_t *op;
+    int *cur, i, n = 0;
+
+    items = malloc(trace->num_ops * sizeof(item_t) + 1);
+    cur = malloc(trace->num_ids * sizeof(int) + 1);
+    if (items == NULL || cur == NULL) {
+	fprintf(stderr, "packbound: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < trace->num_ids; i++)
+	cur[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->index < 0 || op->index >= trace->num_ids)
+	    goto bad;
+	if (op->type != MMB_ALLOC) {
+	    if (cur[op->index] < 0)
+		goto bad;
+	    items[cur[op->index]].end = i;
+	    cur[op->index] = -1;
+	}
+	if (op->type != MMB_FREE) {
+	    items[n].req = op->size;
+	    items[n].size = ALIGN(op->size);
+	    items[n].start = i;
+	    items[n].end = trace->num_ops;  /* never freed */
+	    cur[op->index] = n++;
+	}
+    }
+    free(cur);
+    *itemsp = items;
+    return n;
+
+ bad:
+    free(cur);
+    free(items);
+    return -1;
+}
+
+/* Events for max_load: frees sort before allocations at the same request */
+typedef struct {
+    int time;
+    long delta;
+} event_t;
+
+static int cmp_event(const void *a, const void *b)
+{
+    const event_t *x = a, *y = b;
+
+    if (x->time != y->time)
+	return x->time < y->time ? -1 : 1;
+    return (x->delta > y->delta) - (x->delta < y->delta);
+}
+
+/*
+ * max_load - Most bytes live at any one request (aligned or as requested)
+ */
+static unsigned long max_load(item_t *items, int n, int aligned)
+{
+    event_t *ev;
+    unsigned long live = 0, max = 0;
+    int i;
+
+    if ((ev = malloc(2 * n * sizeof(event_t) + 1)) == NULL) {
+	fprintf(stderr, "packbound: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++) {
+	long size = aligned ? items[i].size : items[i].req;
+
+	ev[2*i].time = items[i].start;
+	ev[2*i].delta = size;
+	ev[2*i+1].time = items[i].end;
+	ev[2*i+1].delta = -size;
+    }
+    qsort(ev, 2 * n, sizeof(event_t), cmp_event);
+    for (i = 0; i < 2 * n; i++) {
+	live += ev[i].delta;
+	if (live > max)
+	    max = live;
+    }
+    free(ev);
+    return max;
+}
+
+/*
+ * lowest_fit - Lowest offset at which item i clears every placed item
+ *     that is live at the same time
+ */
+static unsigned long lowest_fit(pack_t *p, int i)
+{
+    item_t *it = &p->items[i], *other;
+    unsigned long pos = 0;
+    int j, k;
+
+    for (k = 0; k < p->nplaced; k++) {
+	j = p->placed[k];
+	other = &p->items[j];
+	if (other->start >= it->end || it->start >= other->end)
+	    continue;
+	if (p->off[j] >= pos + it->size)
+	    break;
+	if (p->off[j] + other->size > pos)
+	    pos = p->off[j] + other->size;
+    }
+    return pos;
+}
+
+/*
+ * place - Put item i at offset off, keeping placed[] sorted by offset.
+ *     Returns where in placed[] it went
+ */
+static int place(pack_t *p, int i, unsigned long off)
+{
+    int lo = 0, hi = p->nplaced, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (p->off[p->placed[mid]] <= off)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    memmove(&p->placed[lo + 1], &p->placed[lo], (p->nplaced - lo) * sizeof(int));
+    p->placed[lo] = i;
+    p->off[i] = off;
+    p->nplaced++;
+    return lo;
+}
+
+/*
+ * pack_order - Place every item at its lowest fit in the given order;
+ *     returns the height of the packing
+ */
+static unsigned long pack_order(pack_t *p, int *order)
+{
+    unsigned long height = 0;
+    int k, i;
+
+    p->nplaced = 0;
+    for (k = 0; k < p->nitems; k++) {
+	i = order[k];
+	place(p, i, lowest_fit(p, i));
+	if (p->off[i] + p->items[i].size > height)
+	    height = p->off[i] + p->items[i].size;
+    }
+    return height;
+}
+
+/* Orders for pack_heuristic, ties broken by arrival */
+static item_t *sort_items;
+
+static int cmp_size(const void *a, const void *b)
+{
+    item_t *x = &sort_items[*(const int *)a], *y = &sort_items[*(const int *)b];
+
+    if (x->size != y->size)
+	return x->size > y->size ? -1 : 1;
+    return x->start - y->start;
+}
+
+static int cmp_life(const void *a, const void *b)
+{
+    item_t *x = &sort_items[*(const int *)a], *y = &sort_items[*(const int *)b];
+
+    if (x->end - x->start != y->end - y->start)
+	return (y->end - y->start) - (x->end - x->start);
+    return x->start - y->start;
+}
+
+static int cmp_area(const void *a, const void *b)
+{
+    item_t *x = &sort_items[*(const int *)a], *y = &sort_items[*(const int *)b];
+    double ax = (double)x->size * (x->end - x->start);
+    double ay = (double)y->size * (y->end - y->start);
+
+    if (ax != ay)
+	return ax > ay ? -1 : 1;
+    return x->start - y->start;
+}
+
+/*
+ * pack_heuristic - Height of the best lowest-fit packing among arrival
+ *     order (what an address-ordered first fit would do), decreasing
+ *     size, decreasing lifetime and decreasing area
+ */
+static unsigned long pack_heuristic(pack_t *p)
+{
+    int (*cmps[])(const void *, const void *) = {NULL, cmp_size, cmp_life, cmp_area};
+    unsigned long height, best = 0;
+    int *order, i, k;
+
+    if ((order = malloc(p->nitems * sizeof(int) + 1)) == NULL) {
+	fprintf(stderr, "packbound: out of memory\n");
+	exit(1);
+    }
+    sort_items = p->items;
+    for (k = 0; k < sizeof(cmps) / sizeof(cmps[0]); k++) {
+	for (i = 0; i < p->nitems; i++)
+	    order[i] = i;
+	if (cmps[k] != NULL)
+	    qsort(order, p->nitems, sizeof(int), cmps[k]);
+	height = pack_order(p, order);
+	if (k == 0 || height < best)
+	    best = height;
+    }
+    free(order);
+    return best;
+}
+
+/*
+ * search - Try every unplaced item next, at its lowest fit, below best
+ */
+static void search(pack_t *p, unsigned long height)
+{
+    item_t *it, *prev;
+    unsigned long off, h;
+    int i, j, k, dup;
+
+    if (p->nplaced == p->nitems) {
+	p->best = height;
+	return;
+    }
+    for (i = 0; i < p->nitems && p->best > p->lb; i++) {
+	if (p->used[i] || ++p->nodes > p->max_nodes)
+	    continue;
+
+	/* Identical items are interchangeable; try only the first */
+	it = &p->items[i];
+	for (dup = 0, j = 0; j < i && !dup; j++) {
+	    prev = &p->items[j];
+	    dup = !p->used[j] && prev->size == it->size &&
+		prev->start == it->start && prev->end == it->end;
+	}
+	if (dup)
+	    continue;
+
+	off = lowest_fit(p, i);
+	h = off + it->size > height ? off + it->size : height;
+	if (h >= p->best)
+	    continue;
+	k = place(p, i, off);
+	p->used[i] = 1;
+	search(p, h);
+	p->used[i] = 0;
+	p->nplaced--;
+	memmove(&p->placed[k], &p->placed[k + 1], (p->nplaced - k) * sizeof(int));
+    }
+}
+
+/*
+ * pack_exact - Lowest packing height, by branch and bound on the order
+ *     items are placed at their lowest fit. ub is a packing already
+ *     found and lb a height none can beat. Sets p->best and returns 1,
+ *     or 0 if the search gave up
+ */
+static int pack_exact(pack_t *p, unsigned long ub, unsigned long lb)
+{
+    p->best = ub;
+    p->lb = lb;
+    p->nodes = 0;
+    p->max_nodes = EXACT_WORK / (p->nitems + 1);
+    p->nplaced = 0;
+    memset(p->used, 0, p->nitems);
+    search(p, 0);
+    return p->nodes <= p->max_nodes;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: packbound [-hH] [-k <k>] [-n <blocks>] [-t <dir> | <trace> ...]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Start mm_malloc with the trace's hints.\n");
+    fprintf(stderr, "\t-k <k>     mm_malloc placement, as in mdriver.\n");
+    fprintf(stderr, "\t-n <blocks> Search traces up to this size exactly (default %d).\n",
+	    EXACT_ITEMS);
+    fprintf(stderr, "\t-t <dir>   Directory of the default traces.\n");
+}
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+#
+# tracemin.py - Shrink a trace to a small one that still shows a
+#               util or throughput regression between two drivers
+#
+# Usage: tracemin.py [-m util|thru] [-g <gap>] [-o <file>] <trace> <good> <bad>
+#
+# <good> and <bad> are mdriver command lines, e.g. "old/mdriver" and
+# "./mdriver -k 8"; each is run as "<cmd> -a -v -f <trace>". The
+# regression is the amount by which bad trails good: percentage points
+# of util, or percent of throughput. A candidate trace reproduces it if
+# the gap is still at least <gap> (default: half the gap on the input).
+#
+# The trace is cut up into block lifetimes (an alloc, its reallocs and
+# its free), and lifetimes are removed with ddmin; then single reallocs
+# and frees are. Either way every id is still allocated before it is
+# used, and the survivors are renumbered 0..n-1 in allocation order, so
+# the result passes read_trace's checks.
+#
+import os
+import re
+import shlex
+import subprocess
+import sys
+import tempfile
+from getopt import getopt, GetoptError
+
+RESULT = re.compile(r'^\s*0\s+yes\s+(\d+)%\s+\d+\s+[\d.]+\s+(\d+)\s*$')
+
+
+def usage():
+    sys.stderr.write("Usage: tracemin.py [-h] [-m util|thru] [-g <gap>] "
+                     "[-o <file>] <trace> <good> <bad>\n")
+    sys.stderr.write("Options\n")
+    sys.stderr.write("\t-g <gap>   Smallest gap that still counts (default: "
+                     "half the input's).\n")
+    sys.stderr.write("\t-h         Print this message.\n")
+    sys.stderr.write("\t-m <what>  Regression in util (default) or thru.\n")
+    sys.stderr.write("\t-o <file>  Write the result to <file> (default: "
+                     "<trace>.min).\n")
+
+
+def read_trace(path):
+    """Return the header words and a list of lifetimes in allocation
+    order, each a list of ops [type, (size,) seq] with the alloc first;
+    seq is the op's place in the trace"""
+    with open(path) as f:
+        words = f.read().split()
+    header, words = words[:4], words[4:]
+    lives, live = [], {}
+    i = seq = 0
+    while i < len(words):
+        op = words[i]
+        if op == 'f':
+            live.pop(words[i + 1]).append(['f', seq])
+            i += 2
+        elif op == 'a':
+            live[words[i + 1]] = [['a', words[i + 2], seq]]
+            lives.append(live[words[i + 1]])
+            i += 3
+        else:
+            live[words[i + 1]].append(['r', words[i + 2], seq])
+            i += 3
+        seq += 1
+    return header, lives
+
+
+def write_trace(path, header, lives):
+    """Write lives in their original interleaving, with dense ids"""
+    ops = []
+    for n, life in enumerate(lives):
+        for op in life:
+            ops.append((op[-1], n, op))
+    ops.sort(key=lambda t: t[0])
+    with open(path, 'w') as f:
+        f.write("%s\n%d\n%d\n%s\n" % (header[0], len(lives), len(ops), header[3]))
+        for _, n, op in ops:
+            if op[0] == 'f':
+                f.write("f %d\n" % n)
+            else:
+                f.write("%s %d %s\n" % (op[0], n, op[1]))
+
+
+def measure(cmd, path, what):
+    """Util (percent) or Kops of cmd on the trace at path, or None"""
+    out = subprocess.run(shlex.split(cmd) + ['-a', '-v', '-f', path],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         universal_newlines=True).stdout
+    for line in out.splitlines():
+        m = RESULT.match(line)
+        if m:
+            return float(m.group(1) if what == 'util' else m.group(2))
+    return None
+
+
+class Tester:
+    def __init__(self, header, good, bad, what):
+        self.header, self.good, self.bad, self.what = header, good, bad, what
+        self.gap = None
+        self.runs = 0
+        # mdriver -f takes paths relative to the current directory
+        fd, self.path = tempfile.mkstemp(suffix='.rep', dir='.')
+        self.path = os.path.basename(self.path)
+        os.close(fd)
+
+    def measure_gap(self, lives):
+        write_trace(self.path, self.header, lives)
+        self.runs += 1
+        g = measure(self.good, self.path, self.what)
+        b = measure(self.bad, self.path, self.what)
+        if g is None or b is None:
+            return None
+        return g - b if self.what == 'util' else 100.0 * (g - b) / g
+
+    def __call__(self, lives):
+        if not lives:
+            return False
+        gap = self.measure_gap(lives)
+        return gap is not None and gap >= self.gap
+
+
+def ddmin(items, test):
+    """Zeller's ddmin: a 1-minimal sublist of items that passes test"""
+    n = 2
+    while len(items) >= 2:
+        chunk = (len(items) + n - 1) // n
+        parts = [items[i:i + chunk] for i in range(0, len(items), chunk)]
+        for i, part in enumerate(parts):
+            rest = [x for p in parts[:i] + parts[i + 1:] for x in p]
+            if test(part):
+                items, n = part, 2
+                break
+            if len(parts) > 2 and test(rest):
+                items, n = rest, max(n - 1, 2)
+                break
+        else:
+            if n >= len(items):
+                break
+            n = min(n * 2, len(items))
+        sys.stderr.write("  %d left\n" % len(items))
+    return items
+
+
+def main():
+    what, gap, out = 'util', None, None
+    try:
+        opts, args = getopt(sys.argv[1:], "hm:g:o:")
+    except GetoptError:
+        usage()
+        sys.exit(1)
+    for o, a in opts:
+        if o == '-h':
+            usage()
+            sys.exit(0)
+        elif o == '-m':
+            what = a
+        elif o == '-g':
+            gap = float(a)
+        elif o == '-o':
+            out = a
+    if len(args) != 3 or what not in ('util', 'thru'):
+        usage()
+        sys.exit(1)
+    trace, good, bad = args
+    out = out or trace + '.min'
+
+    header, lives = read_trace(trace)
+    test = Tester(header, good, bad, what)
+    first = test.measure_gap(lives)
+    if first is None or first <= 0:
+        sys.stderr.write("tracemin: bad does not trail good on %s (gap %s)\n"
+                         % (trace, first))
+        sys.exit(1)
+    test.gap = gap if gap is not None else first / 2
+    sys.stderr.write("gap %.1f on %d lifetimes, keeping >= %.1f\n"
+                     % (first, len(lives), test.gap))
+
+    # Whole lifetimes first, then single reallocs and frees within them
+    lives = ddmin(lives, test)
+    ops = [(n, j) for n, life in enumerate(lives)
+           for j in range(1, len(life))]
+
+    def keep(sub):
+        s = set(sub)
+        return [[op for j, op in enumerate(life) if j == 0 or (n, j) in s]
+                for n, life in enumerate(lives)]
+    if ops and test(keep([])):
+        ops = []
+    elif ops:
+        ops = ddmin(ops, lambda sub: test(keep(sub)))
+    lives = keep(ops)
+
+    last = test.measure_gap(lives)
+    os.unlink(test.path)
+    write_trace(out, header, lives)
+    sys.stderr.write("gap %.1f on %d lifetimes (%d ops) after %d runs; "
+                     "wrote %s\n" % (last, len(lives),
+                                     sum(len(l) for l in lives), test.runs, out))
+
+
+if __name__ == '__main__':
+    main()